@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#                This file is part of the Buildbotics firmware.                #
+#                                                                              #
+#                  Copyright (c) 2015 - 2018, Buildbotics LLC                  #
+#                             All rights reserved.                             #
+#                                                                              #
+#     This file ("the software") is free software: you can redistribute it     #
+#     and/or modify it under the terms of the GNU General Public License,      #
+#      version 2 as published by the Free Software Foundation. You should      #
+#      have received a copy of the GNU General Public License, version 2       #
+#     along with the software. If not, see <http://www.gnu.org/licenses/>.     #
+#                                                                              #
+#     The software is distributed in the hope that it will be useful, but      #
+#          WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       #
+#               Lesser General Public License for more details.                #
+#                                                                              #
+#       You should have received a copy of the GNU Lesser General Public       #
+#                License along with the software.  If not, see                 #
+#                       <http://www.gnu.org/licenses/>.                        #
+#                                                                              #
+#                For information regarding this software email:                #
+#                  "Joseph Coffland" <joseph@buildbotics.com>                  #
+#                                                                              #
+
+
+# Checks that resuming a preplan from an older plan's checkpoint gives the same
+# plan as planning the edited file from scratch.  Run where camotics.gplan is
+# importable, e.g. in the gplan dev image:
+#
+#   PYTHONPATH=/mnt/host/camotics/build plan-resume-test.py
+
+import sys
+import os
+import json
+import shutil
+import subprocess
+import tempfile
+
+
+bbctrl = os.path.realpath(os.path.dirname(__file__) + '/../src/py/bbctrl')
+every = 5
+state = {}
+config = {
+    'default-units': 'METRIC',
+    'max-vel':   {axis: 10000 for axis in 'xyz'},
+    'max-accel': {axis: 1000000 for axis in 'xyz'},
+    'max-jerk':  {axis: 50000000 for axis in 'xyz'},
+    'program-start': 'G21 G90 G17',
+}
+
+
+def gcode():
+    '''Moves which rely on the motion mode of earlier lines'''
+    lines = ['F1000 S12000 M3', 'G0 X0 Y0 Z2', 'G1 Z-1']
+
+    for i in range(8):
+        x = i * 20
+        lines += [
+            'G1 X%d Y10' % (x + 5),
+            'X%d Y0' % (x + 10),
+            'G2 X%d Y0 I2.5 J0' % (x + 15),
+            'X%d Y0 I2.5 J0' % (x + 20),
+            'Y-5 Z-2',
+            'G0 Z2',
+            'X%d Y-5' % (x + 20),
+            'G1 Z-1',
+        ]
+
+    return lines + ['G0 Z5', 'M5', 'M2']
+
+
+def write(path, lines):
+    with open(path, 'w') as f:
+        for line in lines: f.write(line + '\n')
+
+
+def run(cwd, name, *args):
+    subprocess.check_call((sys.executable, bbctrl + '/' + name) + args,
+                          cwd = cwd, stdout = subprocess.DEVNULL)
+
+
+def plan(cwd, path, old = None):
+    '''Plans path in cwd like the preplanner, resuming from old if given'''
+    os.mkdir(cwd)
+    cfg = dict(config)
+    args = ['--checkpoint-lines=%d' % every]
+    vertices = 0
+    resume = None
+
+    if old is not None:
+        run(cwd, 'checkpoint.py', 'resume', path, json.dumps(cfg),
+            old + 'checkpoints.json')
+
+        with open(cwd + '/resume.json', 'r') as f: resume = json.load(f)
+
+        cfg.pop('program-start')
+        args.append('--resume=resume.json')
+        vertices = resume['checkpoint']['vertices']
+
+    run(cwd, 'plan.py', cwd + '/resume.gcode' if resume else path,
+        json.dumps(state), json.dumps(cfg), *args)
+    run(cwd, 'chunk.py', 'positions.gz', 'speeds.gz',
+        '--prefix-vertices=%d' % vertices)
+    run(cwd, 'checkpoint.py', 'index', path, json.dumps(config),
+        'checkpoints.json')
+
+    return resume
+
+
+def close(a, b):
+    if isinstance(a, dict):
+        return (isinstance(b, dict) and a.keys() == b.keys() and
+                all(close(a[k], b[k]) for k in a))
+
+    if isinstance(a, list):
+        return (isinstance(b, list) and len(a) == len(b) and
+                all(close(x, y) for x, y in zip(a, b)))
+
+    if isinstance(a, float) and isinstance(b, (int, float)):
+        return abs(a - b) <= 1e-6 * max(1, abs(a))
+
+    return a == b
+
+
+def compare(a, b):
+    failed = []
+
+    for name in ('meta.json', 'chunks.json'):
+        with open(a + '/' + name, 'r') as f: x = json.load(f)
+        with open(b + '/' + name, 'r') as f: y = json.load(f)
+        if not close(x, y): failed.append(name)
+
+    with open(a + '/path.bin', 'rb') as f: x = f.read()
+    with open(b + '/path.bin', 'rb') as f: y = f.read()
+    if x != y: failed.append('path.bin')
+
+    return failed
+
+
+def main():
+    tmp = tempfile.mkdtemp()
+    lines = gcode()
+    failed = 0
+
+    try:
+        # The original plan, stored like the preplanner's old plans
+        write(tmp + '/orig.gcode', lines)
+        plan(tmp + '/orig', tmp + '/orig.gcode')
+        old = tmp + '/old.'
+        for name in ('meta.json', 'chunks.json', 'path.bin',
+                     'checkpoints.json'):
+            dst = old + ('json' if name == 'meta.json' else name)
+            shutil.copyfile(tmp + '/orig/' + name, dst)
+
+        # Edit each line after the first checkpoint
+        for edit in range(every + 1, len(lines) - 1):
+            edited = list(lines)
+            edited[edit - 1] += ' (edited)'
+            path = tmp + '/edit.gcode'
+            write(path, edited)
+
+            scratch, resumed = tmp + '/scratch', tmp + '/resumed'
+            plan(scratch, path)
+            resume = plan(resumed, path, old)
+            line = resume['checkpoint']['line']
+
+            errs = compare(scratch, resumed)
+            print('Edit line %d, resumed at %d: %s' % (
+                edit, line, 'differs ' + ' '.join(errs) if errs else 'ok'))
+            if errs: failed += 1
+
+            shutil.rmtree(scratch)
+            shutil.rmtree(resumed)
+
+    finally: shutil.rmtree(tmp)
+
+    if failed: sys.exit('%d resumed plans differ' % failed)
+
+
+if __name__ == '__main__': main()
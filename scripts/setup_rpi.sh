@@ -9,8 +9,8 @@ apt-get dist-upgrade -y
 
 # Install packages
 apt-get install -y avahi-daemon avrdude minicom python3-pip python3-smbus \
-  i2c-tools python3-rpi.gpio libjpeg8 wiringpi dnsmasq hostapd \
-  iptables-persistent chromium-browser xorg rpd-plym-splash samba
+  i2c-tools python3-rpi.gpio python3-numpy libjpeg8 wiringpi dnsmasq \
+  hostapd iptables-persistent chromium-browser xorg rpd-plym-splash samba
 pip3 install --upgrade tornado sockjs-tornado pyserial
 
 # Clean
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#                This file is part of the Buildbotics firmware.                #
+#                                                                              #
+#                  Copyright (c) 2015 - 2018, Buildbotics LLC                  #
+#                             All rights reserved.                             #
+#                                                                              #
+#     This file ("the software") is free software: you can redistribute it     #
+#     and/or modify it under the terms of the GNU General Public License,      #
+#      version 2 as published by the Free Software Foundation. You should      #
+#      have received a copy of the GNU General Public License, version 2       #
+#     along with the software. If not, see <http://www.gnu.org/licenses/>.     #
+#                                                                              #
+#     The software is distributed in the hope that it will be useful, but      #
+#          WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       #
+#               Lesser General Public License for more details.                #
+#                                                                              #
+#       You should have received a copy of the GNU Lesser General Public       #
+#                License along with the software.  If not, see                 #
+#                       <http://www.gnu.org/licenses/>.                        #
+#                                                                              #
+#                For information regarding this software email:                #
+#                  "Joseph Coffland" <joseph@buildbotics.com>                  #
+#                                                                              #
+################################################################################
+
+# Checks that src/js/toolpath.js decodes every level chunk.py writes back to
+# the planned vertices.  Needs node.
+
+import sys
+import os
+import json
+import gzip
+import shutil
+import subprocess
+import tempfile
+import numpy as np
+
+
+root = os.path.realpath(os.path.dirname(__file__) + '/..')
+lod_factor = 4
+args = ['--chunk-size', '5000', '--lod-factor', str(lod_factor),
+        '--lod-min', '16']
+
+decoder = '''
+var fs = require('fs');
+var toolpath = require(process.argv[1]);
+var index = JSON.parse(fs.readFileSync('chunks.json'));
+var buf = fs.readFileSync('path.bin');
+var data = buf.buffer.slice(buf.byteOffset, buf.byteOffset + buf.length);
+
+function list(a) {
+  return Array.prototype.map.call(a, function (v) {return isNaN(v) ? null : v})
+}
+
+var levels = index.chunks.map(function (chunk) {
+  return chunk.levels.map(function (level) {
+    var r = toolpath.decode(data, level.offset, level, index.origin,
+                            index.quantum);
+    return {positions: list(r.positions), speeds: list(r.speeds)};
+  })
+});
+
+process.stdout.write(JSON.stringify(levels));
+'''
+
+
+def toolpath(count):
+    '''A random walk with rapids, repeated speeds and unknown axes'''
+    rng = np.random.default_rng(1)
+
+    p = np.cumsum(rng.normal(0, 2, (count, 3)), axis = 0)
+    p[::1000] *= 1000 # Long moves need multi-byte deltas
+    p[rng.random((count, 3)) < 0.001] = np.nan
+
+    speeds = rng.choice([np.nan, 300, 1000, 2500.5], count // 8 + 1)
+    s = np.repeat(speeds, 8)[:count]
+
+    return p.astype(np.float32).ravel(), s.astype(np.float32)
+
+
+def write(path, a):
+    with gzip.open(path, 'wb') as f: f.write(a.astype('<f4').tobytes())
+
+
+def check(name, expect, actual, tolerance):
+    expect = np.asarray(expect, dtype = np.float64)
+    actual = np.array(actual, dtype = np.float64) # null -> NaN
+
+    if expect.shape != actual.shape:
+        return '%s: %d values, expected %d' % (name, len(actual), len(expect))
+
+    # Unknown positions decode to the origin but rapids must stay NaN
+    known = ~np.isnan(expect)
+    if not tolerance and (np.isnan(actual) == known).any():
+        return '%s: NaN mismatch' % name
+
+    error = np.abs(expect[known] - actual[known])
+    if len(error) and tolerance < error.max():
+        return '%s: off by %g' % (name, error.max())
+
+
+def run(tmp, count):
+    positions, speeds = toolpath(count)
+    write(tmp + '/positions.gz', positions)
+    write(tmp + '/speeds.gz', speeds)
+
+    subprocess.check_call(['python3', root + '/src/py/bbctrl/chunk.py',
+                           'positions.gz', 'speeds.gz'] + args, cwd = tmp)
+
+    out = subprocess.check_output(['node', '-e', decoder,
+                                   root + '/src/js/toolpath.js'], cwd = tmp)
+    levels = json.loads(out.decode('utf8'))
+
+    with open(tmp + '/chunks.json', 'r') as f: index = json.load(f)
+    size = index['chunkSize']
+    tolerance = index['quantum'] / 2 + 1e-3 # float32 rounding of large values
+    errors = []
+
+    for i, chunk in enumerate(levels):
+        start = i * size
+        end = min(start + size + 1, count)
+
+        for j, level in enumerate(chunk):
+            stride = lod_factor ** j
+            indices = list(range(start, end, stride))
+            if indices[-1] != end - 1: indices.append(end - 1)
+
+            p = positions.reshape(-1, 3)[indices].ravel()
+            name = 'chunk %d level %d' % (i, j)
+            errors.append(check(name + ' positions', p, level['positions'],
+                                tolerance))
+            errors.append(check(name + ' speeds', speeds[indices],
+                                level['speeds'], 0))
+
+    errors = [e for e in errors if e]
+    for e in errors: print(e)
+    print('%d vertices, %d chunks: %s' %
+          (count, len(levels), 'FAILED' if errors else 'ok'))
+
+    return not errors
+
+
+tmp = tempfile.mkdtemp()
+try:
+    ok = all([run(tmp, count) for count in (2, 100, 23456)])
+finally: shutil.rmtree(tmp)
+
+sys.exit(0 if ok else 1)
@@ -35,6 +35,7 @@ setup(
         'scripts/edit-boot-config',
         'scripts/browser',
         ],
-    install_requires = 'tornado sockjs-tornado pyserial pyudev smbus2'.split(),
+    install_requires =
+        'tornado sockjs-tornado pyserial pyudev smbus2 numpy'.split(),
     zip_safe = False,
     )
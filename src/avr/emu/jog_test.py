@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#                 This file is part of the Buildbotics firmware.               #
+#                                                                              #
+#                   Copyright (c) 2015 - 2018, Buildbotics LLC                 #
+#                              All rights reserved.                            #
+#                                                                              #
+#      This file ("the software") is free software: you can redistribute it    #
+#      and/or modify it under the terms of the GNU General Public License,     #
+#       version 2 as published by the Free Software Foundation. You should     #
+#       have received a copy of the GNU General Public License, version 2      #
+#      along with the software. If not, see <http://www.gnu.org/licenses/>.    #
+#                                                                              #
+#      The software is distributed in the hope that it will be useful, but     #
+#           WITHOUT ANY WARRANTY; without even the implied warranty of         #
+#       MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      #
+#                Lesser General Public License for more details.               #
+#                                                                              #
+#        You should have received a copy of the GNU Lesser General Public      #
+#                 License along with the software.  If not, see                #
+#                        <http://www.gnu.org/licenses/>.                       #
+#                                                                              #
+#                 For information regarding this software email:               #
+#                   "Joseph Coffland" <joseph@buildbotics.com>                 #
+#                                                                              #
+################################################################################
+
+'''Runs jogs in bbemu and checks where they end.
+
+Each case starts a fresh emulator, configures X and Y motors, sends timed
+jog commands and checks the final position and state.'''
+
+import sys
+import os
+import time
+import json
+import base64
+import struct
+import select
+import subprocess
+
+
+BBEMU = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'bbemu')
+
+MOTOR = (('vm', 5), ('am', 10), ('jm', 50), ('tr', 5), ('sa', 1.8),
+         ('mi', 16), ('me', 1))
+
+
+def encode_float(x):
+    return base64.b64encode(struct.pack('<f', x))[:-2].decode('utf-8')
+
+
+def encode_axes(axes):
+    return ''.join(axis + encode_float(axes[axis]) for axis in sorted(axes))
+
+
+def jog(**axes): return 'j' + encode_axes(axes)
+def jog_target(**axes): return 'jt' + encode_float(1) + encode_axes(axes)
+def jog_incr(**axes): return 'ji' + encode_float(1) + encode_axes(axes)
+
+
+def run(script, duration):
+    setup = ['$%d%s=%s' % (motor, name, value)
+             for motor in range(2)
+             for name, value in (('an', motor),) + MOTOR]
+    script = [(0, cmd) for cmd in setup + ['r1']] + script
+
+    emu = subprocess.Popen([BBEMU], stdin = subprocess.PIPE,
+                           stdout = subprocess.PIPE,
+                           stderr = subprocess.DEVNULL)
+    os.set_blocking(emu.stdout.fileno(), False)
+
+    start = time.time()
+    state = {}
+    buf = b''
+
+    try:
+        while time.time() - start < duration:
+            t = time.time() - start
+            while len(script) and script[0][0] <= t:
+                emu.stdin.write((script.pop(0)[1] + '\n').encode('utf-8'))
+                emu.stdin.flush()
+
+            if select.select([emu.stdout], [], [], 0.01)[0]:
+                buf += emu.stdout.read() or b''
+                lines = buf.split(b'\n')
+                buf = lines.pop()
+
+                for line in lines:
+                    try: msg = json.loads(line.decode('utf-8'))
+                    except ValueError: continue
+                    if isinstance(msg, dict): state.update(msg)
+
+    finally: emu.kill()
+
+    return state
+
+
+CASES = [
+    ('velocity reverse', [(0.5, jog(x = 1)), (1, jog(x = -1)),
+                          (4, jog(x = 0))],
+     lambda s: s.get('xp', 0) < -10),
+    ('velocity turn', [(0.5, jog(x = 1)), (1.5, jog(x = 0, y = 1)),
+                       (4, jog(y = 0))],
+     lambda s: 10 < s.get('yp', 0)),
+    ('target reverse', [(0.5, jog_target(x = 50)), (0.8, jog_target(x = 0))],
+     lambda s: s.get('xp') == 0),
+    ('target past start', [(0.5, jog_target(x = 50)),
+                           (0.8, jog_target(x = -2))],
+     lambda s: s.get('xp') == -2),
+    ('incremental reverse', [(0.5, jog_incr(x = 20)), (0.8, jog_incr(x = -30))],
+     lambda s: s.get('xp') == -10),
+]
+
+
+def main():
+    failed = 0
+
+    for name, script, check in CASES:
+        state = run(script, 7)
+        ok = (state.get('xx') == 'READY' and not state.get('es') and
+              check(state))
+        if not ok: failed += 1
+
+        print('%-20s %s x=%s y=%s state=%s' % (
+            name, 'ok' if ok else 'FAILED', state.get('xp'), state.get('yp'),
+            state.get('xx')))
+
+    return failed
+
+
+if __name__ == '__main__': sys.exit(main())
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#                 This file is part of the Buildbotics firmware.               #
+#                                                                              #
+#                   Copyright (c) 2015 - 2018, Buildbotics LLC                 #
+#                              All rights reserved.                            #
+#                                                                              #
+#      This file ("the software") is free software: you can redistribute it    #
+#      and/or modify it under the terms of the GNU General Public License,     #
+#       version 2 as published by the Free Software Foundation. You should     #
+#       have received a copy of the GNU General Public License, version 2      #
+#      along with the software. If not, see <http://www.gnu.org/licenses/>.    #
+#                                                                              #
+#      The software is distributed in the hope that it will be useful, but     #
+#           WITHOUT ANY WARRANTY; without even the implied warranty of         #
+#       MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      #
+#                Lesser General Public License for more details.               #
+#                                                                              #
+#        You should have received a copy of the GNU Lesser General Public      #
+#                 License along with the software.  If not, see                #
+#                        <http://www.gnu.org/licenses/>.                       #
+#                                                                              #
+#                 For information regarding this software email:               #
+#                   "Joseph Coffland" <joseph@buildbotics.com>                 #
+#                                                                              #
+################################################################################
+
+'''Runs a probe cycle in bbemu followed by a move, as the host would.
+
+The emulated probe touches at Z=-5.  After the cycle retracts the host
+restarts planning from the position the AVR reports, not the trigger
+position, and the next move must start from there and end on target.'''
+
+import sys
+import os
+import time
+import json
+import base64
+import struct
+import select
+import subprocess
+
+
+BBEMU = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'bbemu')
+
+MOTOR = (('vm', 5), ('am', 10), ('jm', 50), ('tr', 5), ('sa', 1.8),
+         ('mi', 16), ('me', 1))
+
+PROBE_Z = -5
+RETRACT = 1
+
+
+def encode_float(x):
+    return base64.b64encode(struct.pack('<f', x))[:-2].decode('utf-8')
+
+
+def probe(z, velocity):
+    # Probe switch, active and error flags
+    return 'b13' + encode_float(velocity) + 'z' + encode_float(z)
+
+
+def line(start, z):
+    '''A jerk limited move from start to z taking four 100ms sections'''
+    T = 0.1 / 60 # In minutes
+    jerk = abs(z - start) / (2 * T ** 3)
+
+    cmd = 'l' + encode_float(0) + encode_float(jerk * T) + encode_float(jerk)
+    cmd += 'z' + encode_float(z)
+    for section in (0, 2, 4, 6): cmd += str(section) + encode_float(T)
+
+    return cmd
+
+
+class Emu(object):
+    def __init__(self):
+        self.proc = subprocess.Popen(
+            [BBEMU, '--probe-z', str(PROBE_Z)], stdin = subprocess.PIPE,
+            stdout = subprocess.PIPE, stderr = subprocess.DEVNULL)
+        os.set_blocking(self.proc.stdout.fileno(), False)
+        self.state = {}
+        self.buf = b''
+
+
+    def send(self, cmd):
+        self.proc.stdin.write((cmd + '\n').encode('utf-8'))
+        self.proc.stdin.flush()
+
+
+    def wait(self, check, timeout):
+        start = time.time()
+
+        while time.time() - start < timeout:
+            if check(self.state): return True
+
+            if select.select([self.proc.stdout], [], [], 0.01)[0]:
+                self.buf += self.proc.stdout.read() or b''
+                lines = self.buf.split(b'\n')
+                self.buf = lines.pop()
+
+                for line in lines:
+                    try: msg = json.loads(line.decode('utf-8'))
+                    except ValueError: continue
+                    if isinstance(msg, dict): self.state.update(msg)
+
+        return check(self.state)
+
+
+def main():
+    emu = Emu()
+    failed = 0
+
+    def check(name, ok, detail):
+        nonlocal failed
+        if not ok: failed += 1
+        print('%-20s %s %s' % (name, 'ok' if ok else 'FAILED', detail))
+
+    try:
+        for motor in range(3):
+            emu.send('$%dan=%d' % (motor, motor))
+            for name, value in MOTOR:
+                emu.send('$%d%s=%s' % (motor, name, value))
+
+        emu.send('$pt=1') # Normally open
+        emu.send('$pb=%s' % RETRACT)
+        emu.send('r1')
+        emu.send('c') # The AVR starts out flushing
+        emu.wait(lambda s: False, 0.5)
+
+        emu.send(probe(-10, 300))
+        found = emu.wait(lambda s: s.get('xx') == 'HOLDING' and
+                         s.get('pr') == 'Switch found', 10)
+        check('switch found', found, 'state=%s pr=%s' % (
+            emu.state.get('xx'), emu.state.get('pr')))
+        if not found: return failed
+
+        # Let the position report settle
+        emu.wait(lambda s: False, 0.5)
+        tp, z = emu.state.get('ztp'), emu.state.get('zp')
+
+        check('trigger position', tp is not None and
+              abs(tp - PROBE_Z) < 0.1, 'tp=%s' % tp)
+        check('retracted', z is not None and tp is not None and
+              abs(z - (tp + RETRACT)) < 0.1, 'z=%s' % z)
+
+        # What the host does on a Switch found hold
+        emu.send('F')
+        emu.send('c')
+        emu.send('U')
+        emu.send(line(z, 0))
+
+        done = emu.wait(lambda s: s.get('xx') == 'READY' and
+                        s.get('zp') == 0, 5)
+        check('move after probe', done and not emu.state.get('es'),
+              'z=%s state=%s' % (emu.state.get('zp'), emu.state.get('xx')))
+
+    finally: emu.proc.kill()
+
+    return failed
+
+
+if __name__ == '__main__': sys.exit(main())
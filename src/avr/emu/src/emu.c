@@ -25,6 +25,10 @@
 
 \******************************************************************************/
 
+#include "modbus_emu.h"
+#include "exec.h"
+#include "axis.h"
+
 #include <config.h>
 
 #include <avr/io.h>
@@ -42,9 +46,6 @@ void __SPIC_INT_vect();      // DRV8711 SPI
 void __I2C_ISR();            // I2C from RPi
 void __ADCA_CH0_vect();      // Analog input
 void __ADCA_CH1_vect();      // Analog input
-void __RS485_DRE_vect();     // RS848
-void __RS485_TXC_vect();     // RS848
-void __RS485_RXC_vect();     // RS848
 void __SERIAL_DRE_vect();    // Serial to RPi
 void __SERIAL_RXC_vect();    // Serial from RPi
 void __STEP_LOW_LEVEL_ISR(); // Stepper lo interrupt
@@ -61,6 +62,8 @@ volatile uint8_t io_mem[4096] = {0};
 
 
 bool fast = false;
+bool probe = false;
+float probe_z = 0;
 int serialByte = -1;
 uint8_t i2cData[I2C_MAX_DATA];
 int i2cIndex = 0;
@@ -76,6 +79,10 @@ void emu_init() {
   // Parse command line args
   for (int i = 0; i < __argc; i++)
     if (strcmp(__argv[i], "--fast") == 0) fast = true;
+    else if (strcmp(__argv[i], "--probe-z") == 0 && i + 1 < __argc) {
+      probe = true;
+      probe_z = atof(__argv[++i]);
+    }
 
   // Mark clocks ready
   OSC.STATUS = OSC_XOSCRDY_bm | OSC_PLLRDY_bm | OSC_RC32KRDY_bm;
@@ -87,6 +94,8 @@ void emu_init() {
   PIN_PORT(MOTOR_FAULT_PIN)->IN |= PIN_BM(MOTOR_FAULT_PIN);
 
   FD_ZERO(&readFDs);
+
+  modbus_emu_init(__argc, __argv);
 }
 
 
@@ -155,6 +164,18 @@ void emu_callback() {
   for (int motor = 0; motor < 4; motor++) motor_emulate_steps(motor);
   __STEP_TIMER_ISR();
 
+  // Normally open probe touching at or below Z, the pin is pulled up
+  if (probe) {
+    float p[AXES];
+    exec_get_position(p);
+
+    if (p[AXIS_Z] <= probe_z) PIN_PORT(PROBE_PIN)->IN &= ~PIN_BM(PROBE_PIN);
+    else PIN_PORT(PROBE_PIN)->IN |= PIN_BM(PROBE_PIN);
+  }
+
+  // Emulate RS485 bus
+  modbus_emu_callback();
+
   // Call RTC
   __RTC_OVF_vect();
 
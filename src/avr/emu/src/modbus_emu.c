@@ -0,0 +1,492 @@
+/******************************************************************************\
+
+                  This file is part of the Buildbotics firmware.
+
+                    Copyright (c) 2015 - 2018, Buildbotics LLC
+                               All rights reserved.
+
+       This file ("the software") is free software: you can redistribute it
+       and/or modify it under the terms of the GNU General Public License,
+        version 2 as published by the Free Software Foundation. You should
+        have received a copy of the GNU General Public License, version 2
+       along with the software. If not, see <http://www.gnu.org/licenses/>.
+
+       The software is distributed in the hope that it will be useful, but
+            WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+                 Lesser General Public License for more details.
+
+         You should have received a copy of the GNU Lesser General Public
+                  License along with the software.  If not, see
+                         <http://www.gnu.org/licenses/>.
+
+                  For information regarding this software email:
+                    "Joseph Coffland" <joseph@buildbotics.com>
+
+\******************************************************************************/
+
+/* Simulated Modbus slave on the emulated RS485 bus.
+
+   Answers the firmware's requests with the register map of the selected
+   spindle type, taken from the active VFD program or the Huanyang protocol.
+   Responses can be delayed, corrupted or dropped to exercise modbus.c.
+
+   Options:
+
+     --modbus-latency <ms>   Delay before responding
+     --modbus-drop <%>       Percent of requests not answered
+     --modbus-corrupt <%>    Percent of responses with a corrupted byte
+     --modbus-absent <id>    Slave ID which never answers
+     --modbus-bench <type>   Select spindle type <type> and alternate its
+                             speed, reporting speed change latency and fault
+                             recovery times on stderr
+*/
+
+#include "modbus_emu.h"
+
+#include <config.h>
+#include <spindle.h>
+#include <vfd_spindle.h>
+#include <huanyang.h>
+#include <rtc.h>
+
+#include <avr/io.h>
+#include <util/crc16.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+// Firmware ISRs
+void __RS485_DRE_vect();
+void __RS485_TXC_vect();
+void __RS485_RXC_vect();
+void __MODBUS_TIMER_OVF_vect();
+
+// Firmware var callbacks
+uint8_t get_mb_id();
+void set_tool_type(uint8_t value);
+uint8_t get_vfd_reg_type(int reg);
+uint16_t get_vfd_reg_addr(int reg);
+uint16_t get_vfd_reg_val(int reg);
+uint8_t get_vfd_reg_id(int reg);
+
+
+#define FRAME_SIZE    64
+#define MAX_REGS      64
+#define MAX_FREQ      40000 // 400.00Hz
+#define RATED_RPM     24000
+#define BENCH_PERIOD  1000  // ms between speed changes
+
+
+typedef struct {
+  uint8_t id;
+  uint16_t addr;
+  uint16_t value;
+} emu_reg_t;
+
+
+typedef struct {
+  unsigned count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t total;
+} emu_stats_t;
+
+
+static struct {
+  // Options
+  unsigned latency;
+  unsigned drop;
+  unsigned corrupt;
+  unsigned absent;
+  int bench_type;
+
+  // Bus
+  uint8_t request[FRAME_SIZE];
+  unsigned request_length;
+  uint8_t response[FRAME_SIZE];
+  unsigned response_length;
+  uint32_t response_time;
+  bool responding;
+
+  // Slave
+  emu_reg_t regs[MAX_REGS];
+  unsigned num_regs;
+  uint16_t freq;
+  bool running;
+  bool reversed;
+
+  // Benchmark
+  float power;
+  uint32_t next_change;
+  uint32_t change_time;
+  uint16_t target_freq;
+  bool changing;
+  uint32_t fault_time;
+  bool faulted;
+  unsigned missed;
+  emu_stats_t latency_stats;
+  emu_stats_t recovery_stats;
+} emu = {0, 0, 0, 0, -1};
+
+
+static uint16_t _word(const uint8_t *data) {return data[0] << 8 | data[1];}
+
+
+static void _put_word(uint8_t *dst, uint16_t value) {
+  dst[0] = value >> 8;
+  dst[1] = value;
+}
+
+
+static bool _chance(unsigned percent) {
+  return percent && (unsigned)(rand() % 100) < percent;
+}
+
+
+static void _stats_add(emu_stats_t &s, uint32_t value) {
+  if (!s.count || value < s.min) s.min = value;
+  if (!s.count || s.max < value) s.max = value;
+  s.total += value;
+  s.count++;
+}
+
+
+static void _stats_print(const char *name, const emu_stats_t &s) {
+  if (!s.count) return;
+  fprintf(stderr, "modbus-emu: %s min=%ums avg=%.1fms max=%ums n=%u\n", name,
+          s.min, (float)s.total / s.count, s.max, s.count);
+}
+
+
+static void _fault() {
+  if (emu.faulted) return;
+  emu.faulted = true;
+  emu.fault_time = rtc_get_time();
+}
+
+
+static void _recovered() {
+  if (!emu.faulted) return;
+  emu.faulted = false;
+  _stats_add(emu.recovery_stats, rtc_get_time() - emu.fault_time);
+}
+
+
+static void _freq_set(uint16_t freq) {
+  emu.freq = freq;
+
+  if (!emu.changing || 1 < abs((int)freq - (int)emu.target_freq)) return;
+  emu.changing = false;
+  _stats_add(emu.latency_stats, rtc_get_time() - emu.change_time);
+}
+
+
+static uint16_t _output_freq() {return emu.running ? emu.freq : 0;}
+
+
+static emu_reg_t *_find_reg(uint8_t id, uint16_t addr) {
+  for (unsigned i = 0; i < emu.num_regs; i++)
+    if (emu.regs[i].id == id && emu.regs[i].addr == addr) return &emu.regs[i];
+
+  return 0;
+}
+
+
+static bool _is_vfd_reg(int reg, uint8_t id) {
+  uint8_t reg_id = get_vfd_reg_id(reg);
+  return reg_id ? reg_id == id : id == get_mb_id();
+}
+
+
+static uint16_t _read_reg(uint8_t id, uint16_t addr) {
+  // Registers with behavior defined by the VFD program
+  for (int i = 0; i < VFDREG; i++) {
+    if (!_is_vfd_reg(i, id)) continue;
+    uint16_t regAddr = get_vfd_reg_addr(i);
+
+    switch (get_vfd_reg_type(i)) {
+    case REG_MAX_FREQ_READ: if (regAddr == addr) return MAX_FREQ; break;
+    case REG_FREQ_READ: if (regAddr == addr) return _output_freq(); break;
+
+    case REG_FREQ_SIGN_READ:
+      if (regAddr == addr)
+        return emu.reversed ? -(int16_t)_output_freq() : _output_freq();
+      break;
+
+    case REG_FREQ_ACTECH_READ:
+      if (regAddr + 1 == addr) return _output_freq();
+      break;
+
+    case REG_STATUS_READ: if (regAddr == addr) return emu.running; break;
+    default: break;
+    }
+  }
+
+  emu_reg_t *reg = _find_reg(id, addr);
+  return reg ? reg->value : 0;
+}
+
+
+static void _write_reg(uint8_t id, uint16_t addr, uint16_t value) {
+  for (int i = 0; i < VFDREG; i++) {
+    if (!_is_vfd_reg(i, id) || get_vfd_reg_addr(i) != addr) continue;
+
+    switch (get_vfd_reg_type(i)) {
+    case REG_FREQ_SET: _freq_set(value); break;
+
+    case REG_FREQ_SIGN_SET:
+      _freq_set(abs((int16_t)value));
+      emu.reversed = (int16_t)value < 0;
+      break;
+
+    case REG_STOP_WRITE:
+      if (get_vfd_reg_val(i) == value) emu.running = false;
+      break;
+
+    case REG_FWD_WRITE: case REG_REV_WRITE:
+      if (get_vfd_reg_val(i) == value) {
+        emu.running = true;
+        emu.reversed = get_vfd_reg_type(i) == REG_REV_WRITE;
+      }
+      break;
+
+    default: break;
+    }
+  }
+
+  emu_reg_t *reg = _find_reg(id, addr);
+  if (!reg && emu.num_regs < MAX_REGS) {
+    reg = &emu.regs[emu.num_regs++];
+    reg->id = id;
+    reg->addr = addr;
+  }
+
+  if (reg) reg->value = value;
+}
+
+
+static void _exception(uint8_t code) {
+  emu.response[1] |= 0x80;
+  emu.response[2] = code;
+  emu.response_length = 3;
+}
+
+
+static void _modbus_request(const uint8_t *req, unsigned length) {
+  uint8_t id = req[0];
+  uint16_t addr = _word(req + 2);
+
+  switch (req[1]) {
+  case 3: { // Read holding registers
+    uint16_t count = _word(req + 4);
+    if (FRAME_SIZE < 2 * (unsigned)count + 5) return _exception(3);
+
+    emu.response[2] = 2 * count;
+    for (unsigned i = 0; i < count; i++)
+      _put_word(emu.response + 3 + 2 * i, _read_reg(id, addr + i));
+    emu.response_length = 3 + 2 * count;
+    break;
+  }
+
+  case 6: // Write single register
+    _write_reg(id, addr, _word(req + 4));
+    memcpy(emu.response + 2, req + 2, 4);
+    emu.response_length = 6;
+    break;
+
+  case 16: { // Write multiple registers
+    uint16_t count = _word(req + 4);
+    if (length < 9 + 2 * (unsigned)count) return _exception(3);
+
+    for (unsigned i = 0; i < count; i++)
+      _write_reg(id, addr + i, _word(req + 7 + 2 * i));
+    memcpy(emu.response + 2, req + 2, 4);
+    emu.response_length = 6;
+    break;
+  }
+
+  default: _exception(1); break; // Illegal function
+  }
+}
+
+
+static void _huanyang_request(const uint8_t *req) {
+  uint8_t func = req[1];
+  uint16_t value = 0;
+
+  switch (func) {
+  case 1: // Function read
+    switch (req[3]) {
+    case HY_PD005_MAX_FREQUENCY:   value = MAX_FREQ;  break;
+    case HY_PD144_RATED_MOTOR_RPM: value = RATED_RPM; break;
+    default: break;
+    }
+    break;
+
+  case 3: // Control write
+    emu.running = (req[3] & 1) && !(req[3] & 8);
+    emu.reversed = req[3] & 16;
+    emu.response[2] = 1;
+    emu.response[3] = emu.running ? 9 : 0;
+    emu.response_length = 4;
+    return;
+
+  case 4: // Control read
+    switch (req[3]) {
+    case 1: value = _output_freq(); break;
+    case 3: value = (uint32_t)_output_freq() * RATED_RPM / MAX_FREQ; break;
+    default: break;
+    }
+    break;
+
+  case 5: // Frequency write
+    _freq_set(_word(req + 3));
+    memcpy(emu.response + 2, req + 2, 3);
+    emu.response_length = 5;
+    return;
+
+  default: return;
+  }
+
+  emu.response[2] = 3;
+  emu.response[3] = req[3];
+  _put_word(emu.response + 4, value);
+  emu.response_length = 6;
+}
+
+
+static void _handle_request() {
+  unsigned length = emu.request_length;
+  emu.request_length = 0;
+  emu.responding = false;
+
+  if (length < 4) return;
+
+  // Slaves ignore frames with bad CRCs and do not answer broadcasts
+  uint16_t crc = 0xffff;
+  for (unsigned i = 0; i < length; i++)
+    crc = _crc16_update(crc, emu.request[i]);
+  if (crc || !emu.request[0] || emu.request[0] == emu.absent) return;
+
+  if (_chance(emu.drop)) return _fault();
+
+  memcpy(emu.response, emu.request, 2);
+  emu.response_length = 0;
+
+  if (spindle_get_type() == SPINDLE_TYPE_HUANYANG)
+    _huanyang_request(emu.request);
+  else _modbus_request(emu.request, length);
+
+  if (!emu.response_length) return;
+
+  // CRC
+  crc = 0xffff;
+  for (unsigned i = 0; i < emu.response_length; i++)
+    crc = _crc16_update(crc, emu.response[i]);
+  emu.response[emu.response_length++] = crc;
+  emu.response[emu.response_length++] = crc >> 8;
+
+  if (_chance(emu.corrupt)) {
+    emu.response[rand() % emu.response_length] ^= 1 << (rand() % 8);
+    _fault();
+
+  } else _recovered();
+
+  emu.response_time = rtc_get_time() + emu.latency;
+  emu.responding = true;
+}
+
+
+static void _transmit() {
+  while (RS485_PORT.CTRLA & USART_DREINTLVL_gm) {
+    __RS485_DRE_vect();
+    if (emu.request_length < FRAME_SIZE)
+      emu.request[emu.request_length++] = RS485_PORT.DATA;
+  }
+
+  if (RS485_PORT.CTRLA & USART_TXCINTLVL_gm) {
+    __RS485_TXC_vect();
+    _handle_request();
+  }
+}
+
+
+static void _receive() {
+  if (!emu.responding || !rtc_expired(emu.response_time)) return;
+  emu.responding = false;
+
+  for (unsigned i = 0; i < emu.response_length; i++) {
+    // Response is lost if the master is not listening
+    if (!(RS485_PORT.CTRLA & USART_RXCINTLVL_gm)) break;
+
+    RS485_PORT.DATA = emu.response[i];
+    __RS485_RXC_vect();
+  }
+}
+
+
+static void _bench() {
+  if (emu.bench_type < 0) return;
+
+  if (spindle_get_type() != emu.bench_type) {
+    set_tool_type(emu.bench_type);
+    emu.next_change = rtc_get_time() + BENCH_PERIOD;
+    return;
+  }
+
+  if (!rtc_expired(emu.next_change)) return;
+  emu.next_change = rtc_get_time() + BENCH_PERIOD;
+
+  if (emu.changing)
+    fprintf(stderr, "modbus-emu: speed change missed, total=%u\n",
+            ++emu.missed);
+
+  _stats_print("speed latency", emu.latency_stats);
+  _stats_print("recovery", emu.recovery_stats);
+
+  emu.power = emu.power == 0.25 ? 0.75 : 0.25;
+  emu.target_freq = emu.power * MAX_FREQ;
+  emu.change_time = rtc_get_time();
+  emu.changing = true;
+
+  if (emu.bench_type == SPINDLE_TYPE_HUANYANG) huanyang_set(emu.power);
+  else vfd_spindle_set(emu.power);
+}
+
+
+void modbus_emu_init(int argc, char *argv[]) {
+  for (int i = 1; i + 1 < argc; i++) {
+    if (!strcmp(argv[i], "--modbus-latency")) emu.latency = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--modbus-drop")) emu.drop = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--modbus-corrupt"))
+      emu.corrupt = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--modbus-absent"))
+      emu.absent = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--modbus-bench"))
+      emu.bench_type = atoi(argv[++i]);
+  }
+
+  if (emu.bench_type < SPINDLE_TYPE_HUANYANG) emu.bench_type = -1;
+}
+
+
+void modbus_emu_callback() {
+  _bench();
+
+  // Bus is disabled
+  if (!(RS485_PORT.CTRLB & USART_TXEN_bm)) {
+    emu.request_length = 0;
+    emu.responding = false;
+    return;
+  }
+
+  // Frame timer, at least t3.5 passes between calls
+  if (TIMER_MODBUS.CTRLA) __MODBUS_TIMER_OVF_vect();
+
+  _transmit();
+  _receive();
+}
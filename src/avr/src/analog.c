@@ -28,15 +28,33 @@
 #include "analog.h"
 
 #include "config.h"
+#include "status.h"
 
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include <stdint.h>
+#include <stdio.h>
+
+
+#define RING_BUF_NAME stream_buf
+#define RING_BUF_TYPE uint16_t
+#define RING_BUF_SIZE ANALOG_STREAM_BUF
+#include "ringbuf.def"
 
 
 typedef struct {
   uint8_t pin;
   uint16_t value;
+  int32_t filtered; // Fixed point with ANALOG_FRAC fractional bits
+
+  // Threshold detection
+  float threshold;
+  uint16_t rise_level;
+  uint16_t fall_level;
+  bool high;
+  uint8_t rises;
+  uint8_t falls;
 } analog_port_t;
 
 
@@ -46,11 +64,72 @@ analog_port_t ports[] = {
 };
 
 
-ISR(ADCA_CH0_vect) {ports[0].value = ADCA.CH0.RES;}
-ISR(ADCA_CH1_vect) {ports[1].value = ADCA.CH1.RES;}
+static struct {
+  uint8_t filter;
+  uint16_t stream_period;
+  uint16_t stream_count;
+  bool stream_overrun;
+} an = {0};
+
+
+static void _sample(analog_port_t &p, uint16_t value) {
+  p.value = value;
+
+  // IIR low pass, 2^-filter weight on each new sample
+  int32_t x = (int32_t)value << ANALOG_FRAC;
+  p.filtered += (x - p.filtered) >> an.filter;
+
+  // Threshold crossing with hysteresis
+  uint16_t y = p.filtered >> ANALOG_FRAC;
+  if (!p.high && p.rise_level <= y) {
+    p.high = true;
+    p.rises++;
+
+  } else if (p.high && y <= p.fall_level) {
+    p.high = false;
+    p.falls++;
+  }
+}
+
+
+static void _stream() {
+  if (!an.stream_period || ++an.stream_count < an.stream_period) return;
+  an.stream_count = 0;
+
+  if (stream_buf_space() < ANALOG) {
+    an.stream_overrun = true;
+    return;
+  }
+
+  for (int i = 0; i < ANALOG; i++)
+    stream_buf_push(ports[i].filtered >> ANALOG_FRAC);
+}
+
+
+ISR(ADCA_CH0_vect) {_sample(ports[0], ADCA.CH0.RES);}
+
+
+ISR(ADCA_CH1_vect) {
+  _sample(ports[1], ADCA.CH1.RES);
+  _stream(); // Last channel in the sweep
+}
+
+
+static void _set_threshold(analog_port_t &p, float threshold) {
+  float rise = threshold + ANALOG_HYSTERESIS / 2;
+  float fall = threshold - ANALOG_HYSTERESIS / 2;
+
+  p.threshold = threshold;
+  p.rise_level = 1 < rise ? 0xfff : rise * 0x1000;
+  p.fall_level = fall < 0 ? 0 : fall * 0x1000;
+}
 
 
 void analog_init() {
+  stream_buf_init();
+
+  for (int i = 0; i < ANALOG; i++) _set_threshold(ports[i], 0.5);
+
   // Channel 0
   ADCA.CH0.CTRL = ADC_CH_GAIN_1X_gc | ADC_CH_INPUTMODE_SINGLEENDED_gc;
   ADCA.CH0.MUXCTRL = ADC_CH_MUXPOS_PIN6_gc;
@@ -61,30 +140,83 @@ void analog_init() {
   ADCA.CH1.MUXCTRL = ADC_CH_MUXPOS_PIN7_gc;
   ADCA.CH1.INTCTRL = ADC_CH_INTLVL_LO_gc;
 
+  // Sweep both channels on every RTC overflow, ~1kHz
+  EVSYS.CH7MUX = EVSYS_CHMUX_RTC_OVF_gc;
+
   // ADC
   ADCA.REFCTRL = ADC_REFSEL_INTVCC_gc; // 3.3V / 1.6 = 2.06V
   ADCA.PRESCALER = ADC_PRESCALER_DIV512_gc;
-  ADCA.EVCTRL = ADC_SWEEP_01_gc;
+  ADCA.EVCTRL = ADC_SWEEP_01_gc | ADC_EVSEL_7_gc | ADC_EVACT_SWEEP_gc;
   ADCA.CTRLA = ADC_FLUSH_bm | ADC_ENABLE_bm;
 }
 
 
 float analog_get(unsigned port) {
-  if (1 < port) return 0;
-  return ports[port].value * (1.0 / 0x1000);
+  if (ANALOG <= port) return 0;
+
+  int32_t filtered;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) filtered = ports[port].filtered;
+
+  return filtered * (1.0 / ((uint32_t)0x1000 << ANALOG_FRAC));
 }
 
 
-void analog_rtc_callback() {
-  static uint8_t count = 0;
+bool analog_is_high(unsigned port) {
+  return port < ANALOG ? ports[port].high : false;
+}
+
+
+uint8_t analog_get_edges(unsigned port, bool rise) {
+  if (ANALOG <= port) return 0;
+  return rise ? ports[port].rises : ports[port].falls;
+}
+
 
-  // Every 1/4 sec
-  if (++count == 250) {
-    count = 0;
-    ADCA.CTRLA |= ADC_CH0START_bm | ADC_CH1START_bm;
+/// Send streamed samples to the host in blocks
+void analog_callback() {
+  if (an.stream_overrun) {
+    an.stream_overrun = false;
+    STATUS_WARNING(STAT_OK, "Analog stream overrun");
   }
+
+  if (stream_buf_fill() < ANALOG_STREAM_BLOCK) return;
+
+  printf_P(PSTR("{\"analog_stream\":["));
+
+  for (int i = 0; i < ANALOG_STREAM_BLOCK; i++) {
+    if (i) putchar(',');
+    printf_P(PSTR("%u"), stream_buf_next());
+  }
+
+  printf_P(PSTR("]}\n"));
 }
 
 
 // Var callbacks
 float get_analog_input(int port) {return analog_get(port);}
+float get_analog_threshold(int port) {return ports[port].threshold;}
+
+
+void set_analog_threshold(int port, float threshold) {
+  if (threshold < 0 || 1 < threshold) return;
+
+  // Levels are read by the ADC interrupt
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) _set_threshold(ports[port], threshold);
+}
+
+
+uint8_t get_analog_filter() {return an.filter;}
+
+
+void set_analog_filter(uint8_t filter) {
+  if (filter <= ANALOG_MAX_FILTER) an.filter = filter;
+}
+
+
+uint16_t get_analog_stream() {return an.stream_period;}
+
+
+void set_analog_stream(uint16_t period) {
+  an.stream_period = period;
+  an.stream_count = 0;
+}
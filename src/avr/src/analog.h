@@ -27,7 +27,12 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 
 void analog_init();
 float analog_get(unsigned port);
-void analog_rtc_callback();
+bool analog_is_high(unsigned port);
+uint8_t analog_get_edges(unsigned port, bool rise);
+void analog_callback();
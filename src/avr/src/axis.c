@@ -122,3 +122,22 @@ AXIS_VAR_GET(jerk_max, float)
 AXIS_VAR_SET(velocity_max, float)
 AXIS_VAR_SET(accel_max, float)
 AXIS_VAR_SET(jerk_max, float)
+
+
+/// Limit along the direction @param unit.  Each axis limit is projected on to
+/// the direction and the result is capped at the largest moving axis limit
+/// so a diagonal move is no faster than the fastest axis alone.
+float axis_get_vector_limit(float (*get)(int axis), const float unit[]) {
+  float max = 0;
+  float limit = INFINITY;
+
+  for (int axis = 0; axis < AXES; axis++)
+    if (unit[axis]) {
+      float value = get(axis);
+      if (max < value) max = value;
+      value /= fabs(unit[axis]);
+      if (value < limit) limit = value;
+    }
+
+  return limit < max ? limit : max;
+}
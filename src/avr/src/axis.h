@@ -48,3 +48,4 @@ void axis_map_motors();
 float axis_get_velocity_max(int axis);
 float axis_get_accel_max(int axis);
 float axis_get_jerk_max(int axis);
+float axis_get_vector_limit(float (*get)(int axis), const float unit[]);
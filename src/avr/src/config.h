@@ -97,6 +97,8 @@ enum {
 #define OUTS                     6 // number of supported pin outputs
 #define ANALOG                   2 // number of supported analog inputs
 #define VFDREG                  32 // number of supported VFD modbus registers
+#define ERROR_BINS               8 // following error histogram bins per motor
+#define ERRHIST                 32 // MOTORS * ERROR_BINS
 
 // Switch settings.  See switch.c
 #define SWITCH_DEBOUNCE          5 // ms, default value
@@ -104,32 +106,47 @@ enum {
 #define SWITCH_MAX_DEBOUNCE   5000 // ms
 #define SWITCH_MAX_LOCKOUT   60000 // ms
 
+// Analog settings.  See analog.c
+#define ANALOG_FRAC              8 // Fixed point fraction bits of filter
+#define ANALOG_MAX_FILTER        8 // Max IIR filter shift
+#define ANALOG_HYSTERESIS     0.05 // Threshold hysteresis, fraction of range
+#define ANALOG_STREAM_BUF       64 // Stream samples buffered, power of 2
+#define ANALOG_STREAM_BLOCK     16 // Stream samples per host message
+
 
 // Motor ISRs
 #define STALL_ISR_vect           PORTA_INT1_vect
 #define FAULT_ISR_vect           PORTF_INT1_vect
 
+// Switch edge capture ISRs
+#define PROBE_ISR_vect           PORTF_INT0_vect
+#define LIMIT_ISR_vect           PORTB_INT0_vect
+
 
 /* Interrupt usage:
  *
  *    HI    Step timers                          stepper.c
  *    HI    Serial RX                            usart.c
+ *    HI    Probe & limit switch edge capture    switch.c
  *   MED    Serial TX                            usart.c (* see note)
  *   MED    Modbus serial interrupts             modbus.c
+ *   MED    Modbus frame timer                   modbus.c
  *    LO    Segment execution SW interrupt       stepper.c
  *    LO    I2C Slave                            i2c.c
  *    LO    Real-time clock interrupt            rtc.c
  *    LO    DRV8711 SPI                          drv8711.c
  *    LO    A2D interrupts                       analog.c
  *
+ *    Event channel 7 routes the RTC overflow to the A2D sweep trigger.
+ *
  *    (*) The TX cannot run at LO level or exception reports and other prints
  *        called from a LO interrupt (as in prep_line()) will kill the system
  *        in a permanent loop call in usart_putc() (usart.c).
  */
 
 // Timer assignments
-// NOTE, TCC1 is unused
 #define TIMER_STEP               TCC0 // Step timer (see stepper.h)
+#define TIMER_MODBUS             TCC1 // Modbus frame timer (see modbus.c)
 #define TIMER_PWM                TCD1 // PWM timer  (see pwm.c)
 
 
@@ -151,8 +168,9 @@ enum {
 #define DRV8711_BLANK            (0x32 | DRV8711_BLANK_ABT_bm)
 #define DRV8711_DECAY            (DRV8711_DECAY_DECMOD_MIXED | 16)
 
+#define DRV8711_POLL_PERIOD      10    // ms between driver status reads
 #define DRV8711_STALL            (DRV8711_STALL_SDCNT_2 | \
-                                  DRV8711_STALL_VDIV_4 | 200)
+                                  DRV8711_STALL_VDIV_4)
 #define DRV8711_DRIVE            (DRV8711_DRIVE_IDRIVEP_50  | \
                                   DRV8711_DRIVE_IDRIVEN_100 | \
                                   DRV8711_DRIVE_TDRIVEP_500 | \
@@ -172,6 +190,8 @@ enum {
 #define RS485_DRE_vect           USARTD1_DRE_vect
 #define RS485_TXC_vect           USARTD1_TXC_vect
 #define RS485_RXC_vect           USARTD1_RXC_vect
+#define MODBUS_TIMER_OVF_vect    TCC1_OVF_vect
+#define MODBUS_TIMER_CCA_vect    TCC1_CCA_vect
 
 
 // Modbus settings
@@ -179,6 +199,7 @@ enum {
 #define MODBUS_RETRIES           4   // Number of retries before failure
 #define MODBUS_BUF_SIZE          18  // Max bytes in rx/tx buffers
 #define VFD_QUERY_DELAY          100 // ms
+#define VFD_MAX_READ_WORDS       ((MODBUS_BUF_SIZE - 5) / 2) // Coalesced read
 
 
 // Serial settings
@@ -216,6 +237,9 @@ enum {
 #define CURRENT_SENSE_REF        2.75          // volts
 #define MAX_CURRENT              6             // amps
 #define MAX_IDLE_CURRENT         2             // amps
+#define STALL_CAL_SETTLE         32    // Status reads after threshold change
+#define STALL_CAL_SAMPLES        4096  // Stall free status reads to finish
+#define STALL_CAL_MARGIN         0.75  // Of free running stall threshold
 #define VELOCITY_MULTIPLIER      1000.0
 #define ACCEL_MULTIPLIER         1000000.0
 #define JERK_MULTIPLIER          1000000.0
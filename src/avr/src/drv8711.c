@@ -32,7 +32,7 @@
 #include "estop.h"
 
 #include <avr/interrupt.h>
-#include <util/delay.h>
+#include <util/atomic.h>
 
 #include <string.h>
 #include <stdlib.h>
@@ -57,6 +57,7 @@ typedef enum {
   SS_READ_OFF,
   SS_READ_STATUS,
   SS_CLEAR_STATUS,
+  SS_IDLE,
 } spi_state_t;
 
 
@@ -80,7 +81,16 @@ typedef struct {
 
   drv8711_state_t state;
   current_t drive;
+  current_t cruise;
   current_t idle;
+  drv8711_motion_t motion;
+
+  uint8_t stall_thresh;
+  uint8_t last_stall_thresh;
+  uint8_t stall_cal_prev;
+  bool stall_cal;
+  bool stall_cal_failed;
+  uint16_t stall_cal_count;
   float stall_threspause;
 
   uint8_t microstep;
@@ -89,22 +99,28 @@ typedef struct {
   uint8_t last_torque;
   uint8_t last_microstep;
 
+  uint16_t poll_period;
+  uint16_t poll_ticks;
+  bool poll;
+
   spi_state_t spi_state;
 } drv8711_driver_t;
 
 
 static drv8711_driver_t drivers[DRIVERS] = {
-  {.cs_pin = SPI_CS_0_PIN, .stall_sw = SW_STALL_0},
-  {.cs_pin = SPI_CS_1_PIN, .stall_sw = SW_STALL_1},
-  {.cs_pin = SPI_CS_2_PIN, .stall_sw = SW_STALL_2},
-  {.cs_pin = SPI_CS_3_PIN, .stall_sw = SW_STALL_3},
+  {.cs_pin = SPI_CS_0_PIN, .stall_sw = SW_STALL_0,
+   .poll_period = DRV8711_POLL_PERIOD},
+  {.cs_pin = SPI_CS_1_PIN, .stall_sw = SW_STALL_1,
+   .poll_period = DRV8711_POLL_PERIOD},
+  {.cs_pin = SPI_CS_2_PIN, .stall_sw = SW_STALL_2,
+   .poll_period = DRV8711_POLL_PERIOD},
+  {.cs_pin = SPI_CS_3_PIN, .stall_sw = SW_STALL_3,
+   .poll_period = DRV8711_POLL_PERIOD},
 };
 
 
 typedef struct {
-  bool advance;
-  uint8_t disable_cs_pin;
-
+  bool busy;
   uint16_t command;
   uint16_t response;
   uint8_t driver;
@@ -135,12 +151,20 @@ static bool _driver_active(drv8711_driver_t *drv) {
 }
 
 
+// Full drive current while accelerating, cruise current otherwise
+static const current_t *_driver_drive(drv8711_driver_t *drv) {
+  if (drv->motion == DRV8711_ACCELERATING || !drv->cruise.torque ||
+      drv->drive.torque < drv->cruise.torque) return &drv->drive;
+  return &drv->cruise;
+}
+
+
 static float _driver_get_current(drv8711_driver_t *drv) {
   if (_driver_fault(drv)) return 0;
 
   switch (drv->state) {
   case DRV8711_IDLE: return drv->idle.current;
-  case DRV8711_ACTIVE: return drv->drive.current;
+  case DRV8711_ACTIVE: return _driver_drive(drv)->current;
   default: return 0; // Off
   }
 }
@@ -151,7 +175,7 @@ static uint8_t _driver_get_torque(drv8711_driver_t *drv) {
 
   switch (drv->state) {
   case DRV8711_IDLE:   return drv->idle.torque;
-  case DRV8711_ACTIVE: return drv->drive.torque;
+  case DRV8711_ACTIVE: return _driver_drive(drv)->torque;
   default: return 0; // Off
   }
 }
@@ -162,7 +186,11 @@ static uint16_t _driver_spi_command(drv8711_driver_t *drv) {
   case SS_WRITE_OFF:   return DRV8711_WRITE(DRV8711_OFF_REG,   DRV8711_OFF);
   case SS_WRITE_BLANK: return DRV8711_WRITE(DRV8711_BLANK_REG, DRV8711_BLANK);
   case SS_WRITE_DECAY: return DRV8711_WRITE(DRV8711_DECAY_REG, DRV8711_DECAY);
-  case SS_WRITE_STALL: return DRV8711_WRITE(DRV8711_STALL_REG, DRV8711_STALL);
+
+  case SS_WRITE_STALL:
+    drv->last_stall_thresh = drv->stall_thresh;
+    return DRV8711_WRITE(DRV8711_STALL_REG, DRV8711_STALL | drv->stall_thresh);
+
   case SS_WRITE_DRIVE: return DRV8711_WRITE(DRV8711_DRIVE_REG, DRV8711_DRIVE);
 
   case SS_WRITE_TORQUE:
@@ -174,24 +202,58 @@ static uint16_t _driver_spi_command(drv8711_driver_t *drv) {
     // idling with the driver enabled.
     bool enable = _driver_get_torque(drv);
     drv->last_microstep = drv->microstep;
-    return DRV8711_WRITE(DRV8711_CTRL_REG, DRV8711_CTRL |
-                         (drv->microstep << 3) |
+
+    // Use internal stall detection when a stall threshold is set
+    uint16_t ctrl = DRV8711_CTRL;
+    if (drv->stall_thresh) ctrl &= ~DRV8711_CTRL_EXSTALL_bm;
+
+    return DRV8711_WRITE(DRV8711_CTRL_REG, ctrl | (drv->microstep << 3) |
                          (enable ? DRV8711_CTRL_ENBL_bm : 0));
   }
 
-  case SS_READ_OFF:    return DRV8711_READ(DRV8711_OFF_REG);
+  case SS_READ_OFF:
+    drv->poll = false;
+    return DRV8711_READ(DRV8711_OFF_REG);
+
   case SS_READ_STATUS: return DRV8711_READ(DRV8711_STATUS_REG);
 
   case SS_CLEAR_STATUS:
     drv->reset_flags = false;
     drv->flags = 0;
     return DRV8711_WRITE(DRV8711_STATUS_REG, 0x0fff & ~drv->status);
+
+  case SS_IDLE: break;
   }
 
   return 0; // Should not get here
 }
 
 
+static void _stall_calibrate(drv8711_driver_t *drv) {
+  // Only calibrate at constant velocity with the current threshold written
+  if (drv->motion != DRV8711_CRUISING ||
+      drv->last_stall_thresh != drv->stall_thresh) return;
+
+  if (++drv->stall_cal_count < STALL_CAL_SETTLE) return;
+
+  if (drv->status & DRV8711_STATUS_STD_bm) {
+    // Stall reported while running freely, lower the threshold.  Reaching
+    // zero means calibration failed, restore the previous threshold and
+    // report it from the main loop.
+    drv->stall_cal_count = 0;
+    if (!--drv->stall_thresh) {
+      drv->stall_thresh = drv->stall_cal_prev;
+      drv->stall_cal = false;
+      drv->stall_cal_failed = true;
+    }
+
+  } else if (STALL_CAL_SAMPLES <= drv->stall_cal_count) {
+    drv->stall_thresh *= STALL_CAL_MARGIN;
+    drv->stall_cal = false;
+  }
+}
+
+
 static spi_state_t _driver_spi_next(drv8711_driver_t *drv) {
   // Process response
   switch (drv->spi_state) {
@@ -216,6 +278,8 @@ static spi_state_t _driver_spi_next(drv8711_driver_t *drv) {
 
     // EStop on fatal driver faults
     if (_driver_fault(drv)) estop_trigger(STAT_MOTOR_FAULT);
+
+    if (drv->stall_cal) _stall_calibrate(drv);
     break;
   }
 
@@ -229,11 +293,9 @@ static spi_state_t _driver_spi_next(drv8711_driver_t *drv) {
 
   case SS_READ_STATUS:
     if (drv->reset_flags) return SS_CLEAR_STATUS;
-    if (drv->last_torque != _driver_get_torque(drv)) return SS_WRITE_TORQUE;
-    if (drv->last_microstep != drv->microstep) return SS_WRITE_CTRL;
     // Fall through
 
-  case SS_CLEAR_STATUS: return SS_READ_OFF;
+  case SS_CLEAR_STATUS: return SS_IDLE;
 
   default: break;
   }
@@ -242,53 +304,71 @@ static spi_state_t _driver_spi_next(drv8711_driver_t *drv) {
 }
 
 
-static void _spi_send() {
-  drv8711_driver_t *drv = &drivers[spi.driver];
-
-  // Flush any status errors (TODO check SPI errors)
-  uint8_t x = SPIC.STATUS;
-  x = x;
+static spi_state_t _driver_spi_idle(drv8711_driver_t *drv) {
+  // Pending writes
+  if (drv->reset_flags) return SS_CLEAR_STATUS;
+  if (drv->last_stall_thresh != drv->stall_thresh) return SS_WRITE_STALL;
+  if (drv->last_torque != _driver_get_torque(drv)) return SS_WRITE_TORQUE;
+  if (drv->last_microstep != drv->microstep) return SS_WRITE_CTRL;
 
-  // Read byte
-  *DRV8711_WORD_BYTE_PTR(spi.response, !spi.low_byte) = SPIC.DATA;
+  // Status poll, continuous while calibrating
+  if (drv->poll || drv->stall_cal) return SS_READ_OFF;
 
-  // Advance state and process response
-  if (spi.advance) {
-    spi.advance = false;
+  return SS_IDLE;
+}
 
-    // Handle response and set next state
-    drv->spi_state = _driver_spi_next(drv);
 
-    // Next driver
+static void _spi_start_word() {
+  // Find the next driver with something to send
+  for (int i = 0; i < DRIVERS; i++) {
     if (++spi.driver == DRIVERS) spi.driver = 0; // Wrap around
-    drv = &drivers[spi.driver];
-  }
+    drv8711_driver_t *drv = &drivers[spi.driver];
+
+    if (drv->spi_state == SS_IDLE) drv->spi_state = _driver_spi_idle(drv);
+    if (drv->spi_state == SS_IDLE) continue;
 
-  // Disable CS
-  if (spi.disable_cs_pin) {
-    OUTCLR_PIN(spi.disable_cs_pin); // Set low (inactive)
-    _delay_us(1);
-    spi.disable_cs_pin = 0;
+    // Enable CS.  The setup time before the first clock is covered by
+    // computing the command.
+    OUTSET_PIN(drv->cs_pin); // Set high (active)
+    spi.command = _driver_spi_command(drv);
+
+    // Write high byte
+    spi.low_byte = false;
+    SPIC.DATA = spi.command >> 8;
+    return;
   }
 
-  if (spi.low_byte) {
-    spi.disable_cs_pin = drv->cs_pin; // Schedule next CS disable
-    spi.advance = true; // Word complete
+  spi.busy = false; // All drivers idle
+}
 
-  } else {
-    // Enable CS
-    OUTSET_PIN(drv->cs_pin); // Set high (active)
-    _delay_us(1);
 
-    // Get next command
-    spi.command = _driver_spi_command(drv);
+static void _spi_send() {
+  // Flush any status errors (TODO check SPI errors)
+  uint8_t x = SPIC.STATUS;
+  x = x;
+
+  // Read byte
+  uint8_t data = SPIC.DATA;
+
+  if (!spi.low_byte) {
+    // Write low byte
+    spi.response = data << 8;
+    spi.low_byte = true;
+    SPIC.DATA = spi.command;
+    return;
   }
 
-  // Write byte and prep next read
-  SPIC.DATA = *DRV8711_WORD_BYTE_PTR(spi.command, spi.low_byte);
+  // Word complete.  Different drivers have separate CS lines so the next
+  // word can start immediately.  Processing the response covers the CS
+  // inactive time when the same driver is next.
+  drv8711_driver_t *drv = &drivers[spi.driver];
+  OUTCLR_PIN(drv->cs_pin); // Set low (inactive)
+  spi.response |= data;
+
+  // Handle response and set next state
+  drv->spi_state = _driver_spi_next(drv);
 
-  // Next byte
-  spi.low_byte = !spi.low_byte;
+  _spi_start_word();
 }
 
 
@@ -357,7 +437,52 @@ void drv8711_init() {
   PIN_PORT(SPI_CLK_PIN)->REMAP = PORT_SPI_bm; // Swap SCK and MOSI
   SPIC.INTCTRL = SPI_INTLVL_LO_gc; // interupt level
 
-  _spi_send(); // Kick it off
+  // Kick it off
+  spi.busy = true;
+  spi.driver = DRIVERS - 1;
+  _spi_start_word();
+}
+
+
+void drv8711_rtc_callback() {
+  bool pending = false;
+
+  for (int i = 0; i < DRIVERS; i++) {
+    drv8711_driver_t *drv = &drivers[i];
+
+    // Schedule status poll
+    if (!drv->poll_ticks) {
+      drv->poll = true;
+      drv->poll_ticks = drv->poll_period;
+
+    } else drv->poll_ticks--;
+
+    if (drv->spi_state != SS_IDLE || _driver_spi_idle(drv) != SS_IDLE)
+      pending = true;
+  }
+
+  // Restart SPI if it went idle.  The RTC and SPI interrupts are both low
+  // level so they cannot preempt each other.
+  if (pending && !spi.busy) {
+    spi.busy = true;
+    _spi_start_word();
+  }
+}
+
+
+void drv8711_callback() {
+  for (int i = 0; i < DRIVERS; i++) {
+    bool failed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      failed = drivers[i].stall_cal_failed;
+      drivers[i].stall_cal_failed = false;
+    }
+
+    if (failed)
+      STATUS_ERROR(STAT_STALL_CAL_FAILED, "Motor %d stall calibration failed",
+                   i);
+  }
 }
 
 
@@ -373,6 +498,12 @@ void drv8711_set_state(int driver, drv8711_state_t state) {
 }
 
 
+void drv8711_set_motion(int driver, drv8711_motion_t motion) {
+  if (driver < 0 || DRIVERS <= driver) return;
+  drivers[driver].motion = motion;
+}
+
+
 void drv8711_set_microsteps(int driver, uint16_t msteps) {
   if (driver < 0 || DRIVERS <= driver) return;
   switch (msteps) {
@@ -385,6 +516,12 @@ void drv8711_set_microsteps(int driver, uint16_t msteps) {
 }
 
 
+bool drv8711_stall_enabled(int driver) {
+  if (driver < 0 || DRIVERS <= driver) return false;
+  return drivers[driver].stall_thresh && !drivers[driver].stall_cal;
+}
+
+
 void drv8711_set_stall_callback(int driver, stall_callback_t cb) {
   drivers[driver].stall_cb = cb;
 }
@@ -403,6 +540,19 @@ void set_drive_current(int driver, float value) {
 }
 
 
+float get_cruise_current(int driver) {
+  if (driver < 0 || DRIVERS <= driver) return 0;
+  return drivers[driver].cruise.current;
+}
+
+
+void set_cruise_current(int driver, float value) {
+  if (driver < 0 || DRIVERS <= driver || value < 0) return;
+  if (MAX_CURRENT < value) value = MAX_CURRENT;
+  _current_set(&drivers[driver].cruise, value);
+}
+
+
 float get_idle_current(int driver) {
   if (driver < 0 || DRIVERS <= driver) return 0;
   return drivers[driver].idle.current;
@@ -433,3 +583,38 @@ void set_driver_flags(int driver, uint16_t flags) {
 
 uint16_t get_driver_flags(int driver) {return drivers[driver].flags;}
 bool get_driver_stalled(int driver) {return drivers[driver].stalled;}
+
+
+uint16_t get_driver_poll(int driver) {return drivers[driver].poll_period;}
+void set_driver_poll(int driver, uint16_t value) {
+  drivers[driver].poll_period = value;
+}
+
+
+uint8_t get_stall_threshold(int driver) {return drivers[driver].stall_thresh;}
+
+
+void set_stall_threshold(int driver, uint8_t value) {
+  if (!drivers[driver].stall_cal) drivers[driver].stall_thresh = value;
+}
+
+
+bool get_stall_calibrate(int driver) {return drivers[driver].stall_cal;}
+
+
+void set_stall_calibrate(int driver, bool value) {
+  drv8711_driver_t *drv = &drivers[driver];
+  if (drv->stall_cal == value) return;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (value) {
+      // Start with the most sensitive threshold and work down
+      drv->stall_cal_prev = drv->stall_thresh;
+      drv->stall_thresh = 255;
+      drv->stall_cal_count = 0;
+
+    } else drv->stall_thresh = drv->stall_cal_prev; // Canceled
+
+    drv->stall_cal = value;
+  }
+}
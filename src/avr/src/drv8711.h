@@ -178,11 +178,22 @@ typedef enum {
 } drv8711_state_t;
 
 
+typedef enum {
+  DRV8711_STOPPED,
+  DRV8711_CRUISING,
+  DRV8711_ACCELERATING,
+} drv8711_motion_t;
+
+
 typedef void (*stall_callback_t)(int driver);
 
 
 void drv8711_init();
+void drv8711_rtc_callback();
+void drv8711_callback();
 drv8711_state_t drv8711_get_state(int driver);
 void drv8711_set_state(int driver, drv8711_state_t state);
+void drv8711_set_motion(int driver, drv8711_motion_t motion);
 void drv8711_set_microsteps(int driver, uint16_t msteps);
 void drv8711_set_stall_callback(int driver, stall_callback_t cb);
+bool drv8711_stall_enabled(int driver);
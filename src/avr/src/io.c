@@ -31,8 +31,11 @@
 #include "util.h"
 #include "command.h"
 #include "exec.h"
+#include "state.h"
 #include "rtc.h"
 #include "analog.h"
+#include "switch.h"
+#include "config.h"
 
 #include <ctype.h>
 #include <stdbool.h>
@@ -47,31 +50,76 @@ typedef struct {
 } input_cmd_t;
 
 
+// Digital inputs, in M66 P order
+static const switch_id_t digital_inputs[] = {
+  SW_PROBE,
+  SW_MIN_0, SW_MAX_0, SW_MIN_1, SW_MAX_1,
+  SW_MIN_2, SW_MAX_2, SW_MIN_3, SW_MAX_3,
+};
+
+static const int num_digital =
+  sizeof(digital_inputs) / sizeof(digital_inputs[0]);
+
+
 static input_cmd_t active_cmd = {-1,};
 static uint32_t timeout;
+static uint8_t edges;
 
 
-void io_callback() {
-  if (active_cmd.port == -1) return;
+static bool _is_high(const input_cmd_t &cmd) {
+  if (cmd.digital) return switch_is_active(digital_inputs[cmd.port]);
+  return analog_is_high(cmd.port);
+}
 
-  bool done = false;
-  float result = 0;
-  if (active_cmd.mode == INPUT_IMMEDIATE || rtc_expired(timeout)) done = true;
 
-  // TODO handle modes
+static uint8_t _get_edges(const input_cmd_t &cmd) {
+  bool rise = cmd.mode == INPUT_RISE;
+  if (cmd.digital) return switch_get_edges(digital_inputs[cmd.port], rise);
+  return analog_get_edges(cmd.port, rise);
+}
+
 
-  if (done) {
-    if (active_cmd.digital) { // TODO
-    } else result = analog_get(active_cmd.port);
+static float _get_value(const input_cmd_t &cmd) {
+  if (cmd.digital) return _is_high(cmd);
+  return analog_get(cmd.port);
+}
 
-    printf_P(PSTR("{\"result\": %f}\n"), (double)result);
-    active_cmd.port = -1;
+
+static bool _is_done(const input_cmd_t &cmd) {
+  switch (cmd.mode) {
+  case INPUT_IMMEDIATE: return true;
+  case INPUT_RISE: case INPUT_FALL: return _get_edges(cmd) != edges;
+  case INPUT_HIGH: return _is_high(cmd);
+  case INPUT_LOW: return !_is_high(cmd);
   }
+
+  return true;
+}
+
+
+/// Reports the result of an active input wait when it completes
+void io_callback() {
+  if (active_cmd.port == -1) return;
+
+  float result;
+  if (_is_done(active_cmd)) result = _get_value(active_cmd);
+  else if (rtc_expired(timeout)) result = -1; // Timed out
+  else return;
+
+  printf_P(PSTR("{\"result\": %f}\n"), (double)result);
+  active_cmd.port = -1;
 }
 
 
 static stat_t _exec_cb() {
-  if (active_cmd.port == -1) exec_set_cb(0);
+  // Abandon the wait if stopping, the host replans on restart
+  if (state_get() == STATE_STOPPING) active_cmd.port = -1;
+
+  if (active_cmd.port == -1) {
+    exec_set_cb(0);
+    return STAT_AGAIN;
+  }
+
   return STAT_NOP;
 }
 
@@ -90,6 +138,8 @@ stat_t command_input(char *cmd) {
   // Port index
   if (!isdigit(*cmd)) return STAT_INVALID_ARGUMENTS;
   input_cmd.port = *cmd - '0';
+  if ((input_cmd.digital ? num_digital : ANALOG) <= input_cmd.port)
+    return STAT_INVALID_ARGUMENTS;
   cmd++;
 
   // Mode
@@ -100,6 +150,7 @@ stat_t command_input(char *cmd) {
 
   // Timeout
   if (!decode_float(&cmd, &input_cmd.timeout)) return STAT_BAD_FLOAT;
+  if (input_cmd.timeout < 0) return STAT_INVALID_ARGUMENTS;
 
   command_push(COMMAND_input, &input_cmd);
 
@@ -114,5 +165,6 @@ void command_input_exec(void *data) {
   active_cmd = *(input_cmd_t *)data;
 
   timeout = rtc_get_time() + active_cmd.timeout * 1000;
+  edges = _get_edges(active_cmd);
   exec_set_cb(_exec_cb);
 }
@@ -35,6 +35,8 @@
 #include "config.h"
 #include "SCurve.h"
 
+#include <util/atomic.h>
+
 #include <stdbool.h>
 #include <math.h>
 #include <string.h>
@@ -42,68 +44,208 @@
 #include <stdlib.h>
 
 
+typedef enum {
+  JOG_VELOCITY,    // Axis velocities as a fraction of max velocity
+  JOG_INCREMENTAL, // Axis distances from the current target or position
+  JOG_TARGET,      // Absolute axis positions
+} jog_mode_t;
+
+
 typedef struct {
   bool holding;
   bool writing;
+  bool changed;
 
-  SCurve scurves[AXES];
+  SCurve scurve;
+  float unit[AXES];
+
+  jog_mode_t next_mode;
+  float next_velocity;
   float next[AXES];
+
+  jog_mode_t mode;
+  float velocity;
   float targetV[AXES];
+  float target[AXES];
 } jr_t;
 
 jr_t jr = {0};
 
 
-stat_t jog_exec() {
-  bool done = true;
+static bool _soft_limited(int axis) {
+  return axis_get_soft_limit(axis, true) != axis_get_soft_limit(axis, false) &&
+    axis_get_homed(axis);
+}
+
 
-  // Compute per axis velocities and target positions
-  float target[AXES] = {0,};
-  float velocity_sqr = 0;
+/// Distance along the jog direction to the nearest soft limit
+static float _limit_dist(const float p[]) {
+  float dist = INFINITY;
 
   for (int axis = 0; axis < AXES; axis++) {
-    if (!axis_is_enabled(axis)) continue;
+    if (!jr.unit[axis] || !_soft_limited(axis)) continue;
+
+    float limit = axis_get_soft_limit(axis, jr.unit[axis] < 0);
+    float d = (limit - p[axis]) / jr.unit[axis];
+    if (d < dist) dist = d < 0 ? 0 : d;
+  }
+
+  return dist;
+}
+
+
+/// Turn toward the commanded direction without exceeding max acceleration
+static void _steer(const float dir[], float vel) {
+  float delta[AXES];
+  float len = 0;
+
+  for (int axis = 0; axis < AXES; axis++) {
+    delta[axis] = dir[axis] - jr.unit[axis];
+    len += square(delta[axis]);
+  }
+
+  len = sqrt(len);
+  float max = vel ? jr.scurve.getMaxAcceleration() * SEGMENT_TIME / vel : len;
+  float scale = len <= max ? 1 : max / len;
 
-    // Load next velocity
-    if (!jr.writing)
+  float norm = 0;
+  for (int axis = 0; axis < AXES; axis++) {
+    jr.unit[axis] += delta[axis] * scale;
+    norm += square(jr.unit[axis]);
+  }
+
+  norm = sqrt(norm);
+  for (int axis = 0; axis < AXES; axis++) jr.unit[axis] /= norm;
+}
+
+
+static void _load_next() {
+  if (jr.writing || !jr.changed) return;
+  jr.changed = false;
+
+  jr.mode = jr.next_mode;
+  jr.velocity = jr.next_velocity;
+
+  for (int axis = 0; axis < AXES; axis++)
+    if (jr.mode == JOG_VELOCITY)
       jr.targetV[axis] = jr.next[axis] * axis_get_velocity_max(axis);
+    else jr.target[axis] = jr.next[axis];
+}
 
-    float p = exec_get_axis_position(axis);
-    float vel = jr.scurves[axis].getVelocity();
-    float targetV = jr.targetV[axis];
-    float min = axis_get_soft_limit(axis, true);
-    float max = axis_get_soft_limit(axis, false);
-    bool softLimited = min != max && axis_get_homed(axis);
 
-    // Apply soft limits, if enabled and homed
-    if (softLimited && MIN_VELOCITY < fabs(targetV)) {
-      float dist = jr.scurves[axis].getStoppingDist() *
-        (1 + (JOG_STOPPING_UNDERSHOOT / 100.0));
+/// Commanded direction and speed for velocity jogs
+static float _velocity_dir(float dir[], const float p[]) {
+  float targetV = 0;
 
-      if (vel < 0 && p - dist <= min) targetV = -MIN_VELOCITY;
-      if (0 < vel && max <= p + dist) targetV = MIN_VELOCITY;
-    }
+  for (int axis = 0; axis < AXES; axis++) {
+    if (!axis_is_enabled(axis)) continue;
 
-    // Compute next velocity
-    float v = jr.scurves[axis].next(SEGMENT_TIME, targetV);
+    // Drop axes pushing in to a soft limit
+    float v = jr.targetV[axis];
+    if (_soft_limited(axis) &&
+        ((v < 0 && p[axis] <= axis_get_soft_limit(axis, true)) ||
+         (0 < v && axis_get_soft_limit(axis, false) <= p[axis]))) v = 0;
 
-    // Don't overshoot soft limits
-    float deltaP = v * SEGMENT_TIME;
-    if (softLimited && 0 < deltaP && max < p + deltaP) p = max;
-    else if (softLimited && deltaP < 0 && p + deltaP < min) p = min;
-    else p += deltaP;
+    dir[axis] = v;
+    targetV += square(v);
+  }
 
-    // Not done jogging if still moving
-    if (MIN_VELOCITY < fabs(v) || MIN_VELOCITY < fabs(targetV)) done = false;
+  targetV = sqrt(targetV);
+  if (targetV)
+    for (int axis = 0; axis < AXES; axis++) dir[axis] /= targetV;
 
-    velocity_sqr += square(v);
-    target[axis] = p;
+  return targetV;
+}
+
+
+/// Commanded direction and remaining distance for jogs to a target
+static float _target_dir(float dir[], const float p[]) {
+  float dist = 0;
+
+  for (int axis = 0; axis < AXES; axis++) {
+    dir[axis] = jr.target[axis] - p[axis];
+    dist += square(dir[axis]);
   }
 
-  // Check if we are done
-  if (done) {
+  dist = sqrt(dist);
+  if (dist)
+    for (int axis = 0; axis < AXES; axis++) dir[axis] /= dist;
+
+  return dist;
+}
+
+
+stat_t jog_exec() {
+  _load_next();
+
+  float p[AXES];
+  exec_get_position(p);
+
+  // Commanded direction and speed
+  float dir[AXES] = {0,};
+  float targetV = 0;
+  float remaining = INFINITY;
+
+  if (jr.mode == JOG_VELOCITY) targetV = _velocity_dir(dir, p);
+  else {
+    remaining = _target_dir(dir, p);
+    if (remaining)
+      targetV = jr.velocity * axis_get_vector_limit(axis_get_velocity_max, dir);
+  }
+
+  // Velocity jogs end only when the commanded velocity is zero
+  bool commanded = targetV;
+
+  // Follow the commanded direction, stopping first if it reverses
+  float vel = jr.scurve.getVelocity();
+  bool reversing = false;
+  if (targetV) {
+    float dot = 0;
+    for (int axis = 0; axis < AXES; axis++) dot += jr.unit[axis] * dir[axis];
+
+    if (!vel) memcpy(jr.unit, dir, sizeof(jr.unit));
+    else if (dot <= 0) reversing = true;
+    else _steer(dir, vel);
+  }
+
+  // Project axis limits on to the direction of travel
+  jr.scurve.setMaxVelocity
+    (axis_get_vector_limit(axis_get_velocity_max, jr.unit));
+  jr.scurve.setMaxAcceleration
+    (axis_get_vector_limit(axis_get_accel_max, jr.unit));
+  jr.scurve.setMaxJerk(axis_get_vector_limit(axis_get_jerk_max, jr.unit));
+
+  if (jr.scurve.getMaxVelocity() < targetV)
+    targetV = jr.scurve.getMaxVelocity();
+
+  // Stop at soft limits, if enabled and homed, or at the target
+  float stopDist = _limit_dist(p);
+  if (remaining < stopDist) stopDist = remaining;
+
+  if (reversing) targetV = 0;
+  else if (MIN_VELOCITY < targetV) {
+    float dist = jr.scurve.getStoppingDist() *
+      (1 + (JOG_STOPPING_UNDERSHOOT / 100.0));
+    if (stopDist <= dist) targetV = MIN_VELOCITY;
+  }
+
+  // Compute next velocity
+  float v = jr.scurve.next(SEGMENT_TIME, targetV);
+
+  // Stopped before reversing, set out in the new direction
+  if (reversing && v <= MIN_VELOCITY) {
+    jr.scurve = SCurve();
+    memcpy(jr.unit, dir, sizeof(jr.unit));
+    return STAT_AGAIN;
+  }
+
+  // Check if we are done, never move at zero velocity
+  if (!v || (((jr.mode == JOG_VELOCITY && !commanded) || !remaining) &&
+             v <= MIN_VELOCITY && targetV <= MIN_VELOCITY)) {
+    jr.scurve = SCurve();
     command_reset_position();
     exec_set_velocity(0);
+    exec_set_acceleration(0);
     exec_set_cb(0);
     if (jr.holding) state_holding();
     else state_idle();
@@ -111,8 +253,22 @@ stat_t jog_exec() {
     return STAT_NOP; // Done, no move executed
   }
 
+  // Don't overshoot soft limits or the target
+  float deltaP = v * SEGMENT_TIME;
+  if (stopDist <= deltaP) {
+    deltaP = stopDist;
+    jr.scurve = SCurve(); // Stopped
+  }
+
+  float target[AXES];
+  if (deltaP == remaining) memcpy(target, jr.target, sizeof(target));
+  else
+    for (int axis = 0; axis < AXES; axis++)
+      target[axis] = p[axis] + jr.unit[axis] * deltaP;
+
   // Set velocity and target
-  exec_set_velocity(sqrt(velocity_sqr));
+  exec_set_velocity(v);
+  exec_set_acceleration(jr.scurve.getAcceleration());
   exec_move_to_target(target);
 
   return STAT_OK;
@@ -122,7 +278,9 @@ stat_t jog_exec() {
 void jog_stop() {
   if (state_get() != STATE_JOGGING) return;
   jr.writing = true;
+  jr.next_mode = JOG_VELOCITY;
   for (int axis = 0; axis < AXES; axis++) jr.next[axis] = 0;
+  jr.changed = true;
   jr.writing = false;
 }
 
@@ -136,33 +294,71 @@ stat_t command_jog(char *cmd) {
   // Skip over command code
   cmd++;
 
-  // Get velocities
-  float velocity[AXES] = {0,};
-  stat_t status = decode_axes(&cmd, velocity);
+  // Get mode and velocity
+  jog_mode_t mode = JOG_VELOCITY;
+  float velocity = 1;
+
+  if (*cmd == 'i' || *cmd == 't') {
+    mode = *cmd++ == 'i' ? JOG_INCREMENTAL : JOG_TARGET;
+    if (!decode_float(&cmd, &velocity)) return STAT_BAD_FLOAT;
+    if (velocity <= 0 || 1 < velocity) return STAT_INVALID_ARGUMENTS;
+  }
+
+  // Get velocities, distances or positions
+  float axes[AXES] = {0,};
+  if (mode == JOG_TARGET) exec_get_position(axes);
+  stat_t status = decode_axes(&cmd, axes);
   if (status) return status;
 
   // Check for end of command
   if (*cmd) return STAT_INVALID_ARGUMENTS;
 
+  bool jogging = state_get() == STATE_JOGGING;
+
+  // Incremental jogs continue from the current target, if any
+  if (mode == JOG_INCREMENTAL) {
+    float start[AXES];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (jogging && jr.mode != JOG_VELOCITY && !jr.changed)
+        memcpy(start, jr.target, sizeof(start));
+      else if (jogging && jr.next_mode != JOG_VELOCITY)
+        memcpy(start, jr.next, sizeof(start));
+      else exec_get_position(start);
+    }
+
+    for (int axis = 0; axis < AXES; axis++) axes[axis] += start[axis];
+    mode = JOG_TARGET;
+  }
+
+  // Keep targets on enabled axes and inside soft limits
+  if (mode == JOG_TARGET)
+    for (int axis = 0; axis < AXES; axis++) {
+      if (!axis_is_enabled(axis)) axes[axis] = exec_get_axis_position(axis);
+      else if (_soft_limited(axis)) {
+        float min = axis_get_soft_limit(axis, true);
+        float max = axis_get_soft_limit(axis, false);
+        if (axes[axis] < min) axes[axis] = min;
+        if (max < axes[axis]) axes[axis] = max;
+      }
+    }
+
   // Start jogging
-  if (state_get() != STATE_JOGGING) {
+  if (!jogging) {
     memset(&jr, 0, sizeof(jr));
 
     jr.holding = state_get() == STATE_HOLDING;
 
-    for (int axis = 0; axis < AXES; axis++)
-      if (axis_is_enabled(axis))
-        jr.scurves[axis] =
-          SCurve(axis_get_velocity_max(axis), axis_get_accel_max(axis),
-                 axis_get_jerk_max(axis));
-
     state_jogging();
     exec_set_cb(jog_exec);
   }
 
-  // Set next velocities
+  // Set next velocities or target
   jr.writing = true;
-  for (int axis = 0; axis < AXES; axis++) jr.next[axis] = velocity[axis];
+  jr.next_mode = mode;
+  jr.next_velocity = velocity;
+  for (int axis = 0; axis < AXES; axis++) jr.next[axis] = axes[axis];
+  jr.changed = true;
   jr.writing = false;
 
   return STAT_OK;
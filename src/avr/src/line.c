@@ -32,6 +32,8 @@
 #include "util.h"
 #include "SCurve.h"
 
+#include <util/atomic.h>
+
 #include <math.h>
 #include <float.h>
 #include <string.h>
@@ -67,6 +69,17 @@ static struct {
 } l;
 
 
+// Time in ms of queued lines not yet started, shared with exec interrupt
+static float _queue_time = 0;
+
+
+static float _line_time(const line_t *line) {
+  float time = 0;
+  for (int i = 0; i < 7; i++) time += line->times[i];
+  return time;
+}
+
+
 static void _segment_target(float target[AXES], float d) {
   for (int axis = 0; axis < AXES; axis++)
     target[axis] = l.line.start[axis] + l.line.unit[axis] * d;
@@ -88,6 +101,25 @@ static float _segment_accel(float t) {
 }
 
 
+/// Fill in the velocity at the middle of each power update step of the
+/// segment ending at time @param t.  Forward differences of the S-curve are
+/// used so each step costs only a few adds and multiplies.
+static void _segment_velocities(float vel[], float t, float seg_time) {
+  const float h = seg_time * (1.0 / POWER_MAX_UPDATES);
+  t -= seg_time - 0.5 * h;
+
+  float v = _segment_velocity(t);
+  float a = _segment_accel(t);
+  const float jh = l.jerk * h;
+
+  for (unsigned i = 0; i < POWER_MAX_UPDATES; i++) {
+    vel[i] = v;
+    v += h * (a + 0.5 * jh);
+    a += jh;
+  }
+}
+
+
 static bool _section_next() {
   while (++l.section < 7) {
     if (!l.line.times[l.section]) continue;
@@ -141,8 +173,10 @@ static stat_t _line_exec() {
   // Don't allow overshoot
   if (l.line.length < d) d = l.line.length;
 
-  // Handle synchronous speeds
-  spindle_load_power_updates(l.power_updates, l.lD, d);
+  // Handle synchronous speeds and dynamic power
+  float vel[POWER_MAX_UPDATES];
+  _segment_velocities(vel, t, seg_time);
+  spindle_load_power_updates(l.power_updates, l.lD, d, vel);
   l.lD = d;
 
   // Check if section complete
@@ -229,7 +263,12 @@ stat_t command_line(char *cmd) {
   for (int axis = 0; axis < AXES; axis++)
     if (line.unit[axis]) line.unit[axis] /= line.length;
 
-  // Queue
+  // Queue, an empty queue may have been flushed
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (!command_get_count()) _queue_time = 0;
+    _queue_time += _line_time(&line);
+  }
+
   command_push(COMMAND_line, &line);
 
   return STAT_OK;
@@ -242,6 +281,9 @@ unsigned command_line_size() {return sizeof(line_t);}
 void command_line_exec(void *data) {
   l.line = *(line_t *)data;
 
+  _queue_time -= _line_time(&l.line);
+  if (_queue_time < 0) _queue_time = 0;
+
   // Setup first section
   l.seg = 0;
   l.iD = 0;
@@ -272,3 +314,11 @@ void command_line_exec(void *data) {
   // Set callback
   exec_set_cb(_line_exec);
 }
+
+
+// Var callbacks
+float get_queue_time() {
+  float time;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) time = _queue_time;
+  return command_get_count() ? time : 0;
+}
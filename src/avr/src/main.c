@@ -94,6 +94,8 @@ int main(int argc, char *argv[]) {
     command_callback();           // process next command
     modbus_callback();            // handle modbus events
     io_callback();                // handle io input
+    drv8711_callback();           // report motor driver events
+    analog_callback();            // stream analog samples
     report_callback();            // report changes
   }
 
@@ -47,6 +47,7 @@ typedef enum {
   MODBUS_CRC,
   MODBUS_INVALID,
   MODBUS_TIMEDOUT,
+  MODBUS_EXCEPTION,
 } modbus_status_t;
 
 
@@ -64,13 +65,14 @@ static struct {
   uint8_t command_length;
   uint8_t response[MODBUS_BUF_SIZE];
   uint8_t response_length;
+  uint8_t received;
+  uint16_t rx_crc;
 
   uint16_t addr;
   modbus_rw_cb_t rw_cb;
   modbus_cb_t receive_cb;
 
   uint32_t last_write;
-  uint32_t last_read;
   uint8_t retry;
   uint8_t status;
   uint16_t crc_errs;
@@ -78,6 +80,9 @@ static struct {
   bool response_ready;
   bool transmit_complete;
   bool busy;
+  bool bus_idle;    // At least t3.5 since the last character received
+  bool char_gap;    // At least t1.5 since the last character received
+  bool frame_error; // Frame contained a gap longer than t1.5
 } state = {0};
 
 
@@ -131,21 +136,17 @@ static uint16_t _read_word(const uint8_t *data, bool little_endian) {
 
 
 static bool _check_response() {
-  // Check CRC
-  uint16_t computed = _crc16(state.response, state.response_length - 2);
-  uint16_t expected =
-    _read_word(state.response + state.response_length - 2, true);
-
-  if (computed != expected) {
+  // Check framing and CRC.  The CRC of a valid frame, including its CRC, is
+  // zero.  It is computed as bytes arrive in RS485_RXC_vect.
+  if (state.received < 4 || state.frame_error || state.rx_crc) {
     if (cfg.debug) {
       char sent[state.command_length * 2 + 1];
-      char response[state.response_length * 2 + 1];
+      char response[state.received * 2 + 1];
       format_hex_buf(sent, state.command, state.command_length);
-      format_hex_buf(response, state.response, state.response_length);
+      format_hex_buf(response, state.response, state.received);
 
-      STATUS_WARNING(STAT_OK, "modbus: invalid CRC, received=0x%04x "
-                     "computed=0x%04x sent=0x%s received=0x%s",
-                     expected, computed, sent, response);
+      STATUS_WARNING(STAT_OK, "modbus: invalid %s, sent=0x%s received=0x%s",
+                     state.frame_error ? "frame" : "CRC", sent, response);
     }
 
     state.crc_errs++;
@@ -161,6 +162,14 @@ static bool _check_response() {
     return false;
   }
 
+  // Check for exception response
+  if ((state.command[1] | 0x80) == state.response[1]) {
+    STATUS_WARNING(STAT_OK, "modbus: exception %u, function=%u",
+                   state.response[2], state.command[1]);
+    state.status = MODBUS_EXCEPTION;
+    return false;
+  }
+
   // Check that function code matches
   if (state.command[1] != state.response[1]) {
     STATUS_WARNING(STAT_OK, "modbus: invalid function code, expected=%u got=%u",
@@ -183,19 +192,47 @@ static void _notify(uint8_t func, uint8_t bytes, const uint8_t *data) {
 }
 
 
+static void _retry();
+static void _timeout();
+
+
 static void _handle_response() {
   if (!state.response_ready) return;
   state.response_ready = false;
+  state.last_write = 0; // Clear timeout timer
 
-  if (!_check_response()) return;
+  if (!_check_response()) {
+    // The slave will answer an exception the same way again
+    if (state.status == MODBUS_EXCEPTION) _timeout();
+    else if (state.retry < 2 * MODBUS_RETRIES) _retry();
+    else _timeout();
+    return;
+  }
 
-  state.last_write = 0;             // Clear timeout timer
-  state.last_read = rtc_get_time(); // Set delay timer
-  state.retry = 0;                  // Reset retry counter
+  state.retry = 0; // Reset retry counter
   state.status = MODBUS_OK;
   state.busy = false;
 
-  _notify(state.response[1], state.response_length - 4, state.response + 2);
+  _notify(state.response[1], state.received - 4, state.response + 2);
+}
+
+
+static void _frame_timer_restart() {
+  TIMER_MODBUS.CTRLA = TC_CLKSEL_OFF_gc;
+  TIMER_MODBUS.CNT = 0;
+  TIMER_MODBUS.INTFLAGS = TC1_OVFIF_bm | TC1_CCAIF_bm;
+  TIMER_MODBUS.CTRLA = TC_CLKSEL_DIV64_gc;
+  state.char_gap = false;
+  state.bus_idle = false;
+}
+
+
+static void _end_frame() {
+  _set_rxc_interrupt(false);
+  _set_write(true); // Back to write mode
+  state.received = state.bytes;
+  state.bytes = 0;
+  state.response_ready = true;
 }
 
 
@@ -222,22 +259,45 @@ ISR(RS485_TXC_vect) {
 
 /// Data received interrupt
 ISR(RS485_RXC_vect) {
-  state.response[state.bytes] = RS485_PORT.DATA;
+  uint8_t data = RS485_PORT.DATA;
 
   // Ignore leading zeros
-  if (state.bytes || state.response[0]) state.bytes++;
+  if (!state.bytes && !data) return;
 
-  if (state.bytes == state.response_length) {
-    _set_rxc_interrupt(false);
-    _set_write(true); // Back to write mode
-    state.bytes = 0;
-    state.response_ready = true;
-  }
+  if (!state.bytes) {
+    state.rx_crc = 0xffff;
+    state.frame_error = false;
+
+  } else if (state.char_gap) state.frame_error = true;
+
+  _frame_timer_restart();
+
+  if (state.bytes < MODBUS_BUF_SIZE) state.response[state.bytes++] = data;
+  else state.frame_error = true;
+  state.rx_crc = _crc16_update(state.rx_crc, data);
+
+  // Exception responses are [id][func | 0x80][code][crc]
+  bool exception = 1 < state.bytes && (state.response[1] & 0x80);
+  if (state.bytes == (exception ? 5 : state.response_length)) _end_frame();
+}
+
+
+/// t1.5 character gap
+ISR(MODBUS_TIMER_CCA_vect) {state.char_gap = true;}
+
+
+/// t3.5 silent interval, end of frame
+ISR(MODBUS_TIMER_OVF_vect) {
+  TIMER_MODBUS.CTRLA = TC_CLKSEL_OFF_gc;
+  state.bus_idle = true;
+
+  // Shorter than expected frame
+  if (state.bytes && (RS485_PORT.CTRLA & USART_RXCINTLVL_gm)) _end_frame();
 }
 
 
 static void _read_cb(uint8_t func, uint8_t bytes, const uint8_t *data) {
-  if (func == MODBUS_READ_OUTPUT_REG && data[0] == bytes - 1) {
+  if (func == MODBUS_READ_OUTPUT_REG && bytes && data[0] == bytes - 1) {
     if (state.rw_cb)
       for (uint8_t i = 0; i < bytes >> 1; i++)
         state.rw_cb(true, state.addr + i, _read_word(data + i * 2 + 1, false));
@@ -278,6 +338,9 @@ static void _reset() {
 }
 
 
+static void _start_write();
+
+
 static void _retry() {
   state.last_write = 0;
   state.bytes = 0;
@@ -287,10 +350,12 @@ static void _retry() {
 
   _set_txc_interrupt(false);
   _set_rxc_interrupt(false);
-  _set_dre_interrupt(true);
 
-  // Try changing pin polarity
-  if (state.retry == MODBUS_RETRIES) {
+  state.write_ready = true;
+  _start_write();
+
+  // Try changing pin polarity, unless an auxiliary slave is not answering
+  if (state.retry == MODBUS_RETRIES && state.command[0] == cfg.id) {
     PINCTRL_PIN(RS485_RO_PIN) ^= PORT_INVEN_bm;
     PINCTRL_PIN(RS485_DI_PIN) ^= PORT_INVEN_bm;
   }
@@ -316,8 +381,25 @@ static stop_t _get_stop() {
 }
 
 
+static void _update_frame_timer() {
+  // There are 11-bits per character in RTU mode.  Above 19200 baud the spec
+  // fixes t1.5 at 750uS and t3.5 at 1.75mS.
+  float char_time;
+  switch (cfg.baud) {
+  case USART_BAUD_9600:  char_time = 11.0 / 9600;  break;
+  case USART_BAUD_19200: char_time = 11.0 / 19200; break;
+  default:               char_time = 0.0005;       break;
+  }
+
+  const float freq = F_CPU / 64;
+  TIMER_MODBUS.CCA = 1.5 * char_time * freq;
+  TIMER_MODBUS.PER = 3.5 * char_time * freq;
+}
+
+
 void modbus_init() {
   PR.PRPD &= ~PR_USART1_bm; // Disable power reduction
+  PR.PRPC &= ~PR_TC1_bm;    // Disable power reduction
 
   DIRCLR_PIN(RS485_RO_PIN); // Input
   OUTSET_PIN(RS485_DI_PIN); // High
@@ -328,8 +410,16 @@ void modbus_init() {
   _reset();
   memset(&state, 0, sizeof(state));
   state.status = MODBUS_DISCONNECTED;
+  state.bus_idle = true;
 
   usart_init_port(&RS485_PORT, cfg.baud, cfg.parity, USART_8BITS, _get_stop());
+
+  // Frame timer
+  TIMER_MODBUS.CTRLA = TC_CLKSEL_OFF_gc;
+  TIMER_MODBUS.CTRLB = TC_WGMODE_NORMAL_gc;
+  TIMER_MODBUS.INTCTRLA = TC_OVFINTLVL_MED_gc;
+  TIMER_MODBUS.INTCTRLB = TC_CCAINTLVL_MED_gc;
+  _update_frame_timer();
 }
 
 
@@ -338,6 +428,11 @@ void modbus_deinit() {
   memset(&state, 0, sizeof(state));
   state.status = MODBUS_DISCONNECTED;
 
+  // Stop frame timer
+  TIMER_MODBUS.CTRLA = TC_CLKSEL_OFF_gc;
+  TIMER_MODBUS.INTCTRLA = 0;
+  TIMER_MODBUS.INTCTRLB = 0;
+
   // Disable USART
   RS485_PORT.CTRLB &= ~(USART_RXEN_bm | USART_TXEN_bm);
 
@@ -353,27 +448,17 @@ bool modbus_busy() {return state.busy;}
 static void _start_write() {
   if (!state.write_ready) return;
 
-  // The minimum delay between modbus messages is 3.5 characters.  There are
-  // 11-bits per character in RTU mode.  Character time is calculated as
-  // follows:
-  //
-  //     char time = 11-bits / baud * 3.5
-  //
-  // At 9600 baud the minimum delay is 4.01ms.  At 19200 it's 2.005ms.  All
-  // supported higher baud rates require the 1.75ms minimum delay.  We round up
-  // and add 1ms to ensure the delay is never less than the required minimum.
-  if (state.last_read &&
-      !rtc_expired(state.last_read + (cfg.baud == USART_BAUD_9600 ? 5 : 3)))
-    return;
-  state.last_read = 0;
+  // The minimum delay between modbus messages is 3.5 characters.  This is
+  // timed from the last character received by the frame timer.
+  if (!state.bus_idle) return;
 
   state.write_ready = false;
   _set_dre_interrupt(true);
 }
 
 
-void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
-                 uint8_t receive, modbus_cb_t receive_cb) {
+static void _send(uint8_t id, uint8_t func, uint8_t send, const uint8_t *data,
+                  uint8_t receive, modbus_cb_t receive_cb) {
   state.bytes = 0;
   state.command_length = send + 4;
   state.response_length = receive + 4;
@@ -385,7 +470,7 @@ void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
   ESTOP_ASSERT(state.response_length <= MODBUS_BUF_SIZE,
                STAT_MODBUS_BUF_LENGTH);
 
-  state.command[0] = cfg.id;
+  state.command[0] = id ? id : cfg.id;
   state.command[1] = func;
   memcpy(state.command + 2, data, send);
   _write_word(state.command + send + 2, _crc16(state.command, send + 2), true);
@@ -396,27 +481,37 @@ void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
 }
 
 
-void modbus_read(uint16_t addr, uint16_t count, modbus_rw_cb_t cb) {
+void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
+                 uint8_t receive, modbus_cb_t receive_cb) {
+  _send(cfg.id, func, send, data, receive, receive_cb);
+}
+
+
+/// An @param id of zero addresses the configured bus ID.
+void modbus_read(uint8_t id, uint16_t addr, uint16_t count,
+                 modbus_rw_cb_t cb) {
   state.rw_cb = cb;
   state.addr = addr;
   uint8_t cmd[4];
   _write_word(cmd, addr, false);
   _write_word(cmd + 2, count, false);
-  modbus_func(MODBUS_READ_OUTPUT_REG, 4, cmd, 2 * count + 1, _read_cb);
+  _send(id, MODBUS_READ_OUTPUT_REG, 4, cmd, 2 * count + 1, _read_cb);
 }
 
 
-void modbus_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb) {
+void modbus_write(uint8_t id, uint16_t addr, uint16_t value,
+                  modbus_rw_cb_t cb) {
   state.rw_cb = cb;
   state.addr = addr;
   uint8_t cmd[4];
   _write_word(cmd, addr, false);
   _write_word(cmd + 2, value, false);
-  modbus_func(MODBUS_WRITE_OUTPUT_REG, 4, cmd, 4, _write_cb);
+  _send(id, MODBUS_WRITE_OUTPUT_REG, 4, cmd, 4, _write_cb);
 }
 
 
-void modbus_multi_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb) {
+void modbus_multi_write(uint8_t id, uint16_t addr, uint16_t value,
+                        modbus_rw_cb_t cb) {
   state.rw_cb = cb;
   state.addr = addr;
   uint8_t cmd[7];
@@ -424,7 +519,7 @@ void modbus_multi_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb) {
   _write_word(cmd + 2, 1, false);     // Number of regs
   cmd[4] = 2;                         // Number of bytes
   _write_word(cmd + 5, value, false); // Value
-  modbus_func(MODBUS_WRITE_OUTPUT_REGS, 7, cmd, 4, _write_cb);
+  _send(id, MODBUS_WRITE_OUTPUT_REGS, 7, cmd, 4, _write_cb);
 }
 
 
@@ -469,6 +564,7 @@ uint8_t get_mb_baud() {return cfg.baud;}
 void set_mb_baud(uint8_t baud) {
   cfg.baud = (baud_t)baud;
   usart_set_baud(&RS485_PORT, cfg.baud);
+  _update_frame_timer();
 }
 
 
@@ -38,8 +38,10 @@
 #include "util.h"
 #include "pgmspace.h"
 #include "exec.h"
+#include "state.h"
 
 #include <util/delay.h>
+#include <util/atomic.h>
 
 #include <string.h>
 #include <math.h>
@@ -75,12 +77,20 @@ typedef struct {
   int32_t encoder;
   int16_t error;
   bool last_negative;
+  int32_t latch;
+
+  // Following error
+  uint16_t max_error;
+  uint8_t error_action;
+  uint32_t corrected;
+  uint16_t error_hist[ERROR_BINS];
 
   // Move prep
   bool prepped;
   uint8_t clock;
   uint16_t timer_period;
   bool negative;
+  bool accelerating;
   int32_t position;
 } motor_t;
 
@@ -204,6 +214,12 @@ static void _update_power(int motor) {
     // NOTE, we have ~5ms to update the driver config
     drv8711_set_state(motor, timedout ? DRV8711_IDLE : DRV8711_ACTIVE);
 
+    // Boost current only while an accelerating move is queued or running
+    bool moving = (m->prepped && m->timer_period) || m->timer->CTRLA;
+    drv8711_set_motion(motor, !moving ? DRV8711_STOPPED :
+                       (m->accelerating ? DRV8711_ACCELERATING :
+                        DRV8711_CRUISING));
+
   } else drv8711_set_state(motor, DRV8711_DISABLED);
 }
 
@@ -223,23 +239,57 @@ void motor_emulate_steps(int motor) {
 }
 
 
+static int32_t _move_steps(const motor_t &m) {
+  const int32_t steps = 0xffff - m.dma->TRFCNT;
+  return m.last_negative ? -steps : steps;
+}
+
+
+/// Called from switch capture interrupt
+void motor_latch(int motor) {
+  motor_t &m = motors[motor];
+
+  // Steps in the current move are only counted while the clock runs
+  m.latch = m.encoder;
+  if (m.timer->CTRLA) m.latch += _move_steps(m);
+}
+
+
 void motor_end_move(int motor) {
   motor_t &m = motors[motor];
 
   if (!m.timer->CTRLA) return;
 
-  // Stop clock
-  m.timer->CTRLA = 0;
+  // Must not be interrupted by motor_latch() between stopping the clock and
+  // accumulating the encoder
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // Stop clock
+    m.timer->CTRLA = 0;
 
-  // Wait for pending DMA transfers
-  while (m.dma->CTRLB & DMA_CH_CHPEND_bm) continue;
+    // Wait for pending DMA transfers
+    while (m.dma->CTRLB & DMA_CH_CHPEND_bm) continue;
 
-  // Get actual step count from DMA channel
-  const int32_t steps = 0xffff - m.dma->TRFCNT;
+    // Get actual step count from DMA channel & accumulate encoder
+    m.encoder += _move_steps(m);
+  }
 
-  // Accumulate encoder & compute error
-  m.encoder += m.last_negative ? -steps : steps;
+  // Compute error
   m.error = m.commanded - m.encoder;
+
+  // Error histogram, bins are 0, 1, 2-3, 4-7, ...
+  uint16_t error = abs(m.error);
+  uint8_t bin = 0;
+  while (error && bin < ERROR_BINS - 1) {
+    error >>= 1;
+    bin++;
+  }
+  if (m.error_hist[bin] != 0xffff) m.error_hist[bin]++;
+
+  // Check following error
+  if (m.max_error && m.max_error < abs(m.error)) {
+    if (m.error_action) state_error_estop();
+    else state_error_hold();
+  }
 }
 
 
@@ -301,6 +351,7 @@ void motor_prep_move(int motor, float target) {
 
     // Make correction
     steps += m.error < 0 ? -correction : correction;
+    m.corrected += correction;
   }
 
   // Positive steps from here on
@@ -329,6 +380,7 @@ void motor_prep_move(int motor, float target) {
   if (0xffff <= ticks_per_step) ticks_per_step = 0;
 
   m.timer_period = steps ? round(ticks_per_step) : 0;
+  m.accelerating = m.timer_period && exec_get_acceleration();
 
   // Power motor
   if (!m.enabled) {
@@ -338,10 +390,10 @@ void motor_prep_move(int motor, float target) {
 
   } else if (m.timer_period) // Motor is moving so reset power timeout
     m.power_timeout = rtc_get_time() + MOTOR_IDLE_TIMEOUT * 1000;
-  _update_power(motor);
 
   // Queue move
   m.prepped = true;
+  _update_power(motor);
 }
 
 
@@ -456,4 +508,28 @@ void set_homed(int motor, bool homed) {motors[motor].homed = homed;}
 
 
 int32_t get_encoder(int m) {return motors[m].encoder;}
+float get_latch_position(int m) {return motor_get_latch(m);}
+
+
+float motor_get_latch(int motor) {
+  return motors[motor].latch / motors[motor].steps_per_unit;
+}
+
+
 int32_t get_error(int m) {return motors[m].error;}
+uint16_t get_following_error(int m) {return motors[m].max_error;}
+void set_following_error(int m, uint16_t x) {motors[m].max_error = x;}
+uint8_t get_error_action(int m) {return motors[m].error_action;}
+void set_error_action(int m, uint8_t action) {motors[m].error_action = action;}
+uint32_t get_corrected(int m) {return motors[m].corrected;}
+void set_corrected(int m, uint32_t x) {motors[m].corrected = x;}
+
+
+uint16_t get_error_hist(int i) {
+  return motors[i / ERROR_BINS].error_hist[i % ERROR_BINS];
+}
+
+
+void set_error_hist(int i, uint16_t x) {
+  motors[i / ERROR_BINS].error_hist[i % ERROR_BINS] = x;
+}
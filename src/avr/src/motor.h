@@ -52,6 +52,8 @@ bool motor_get_homed(int motor);
 
 stat_t motor_rtc_callback();
 
+void motor_latch(int motor);
+float motor_get_latch(int motor);
 void motor_end_move(int motor);
 void motor_load_move(int motor);
 void motor_prep_move(int motor, float target);
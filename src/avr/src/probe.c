@@ -0,0 +1,268 @@
+/******************************************************************************\
+
+                 This file is part of the Buildbotics firmware.
+
+                   Copyright (c) 2015 - 2018, Buildbotics LLC
+                              All rights reserved.
+
+      This file ("the software") is free software: you can redistribute it
+      and/or modify it under the terms of the GNU General Public License,
+       version 2 as published by the Free Software Foundation. You should
+       have received a copy of the GNU General Public License, version 2
+      along with the software. If not, see <http://www.gnu.org/licenses/>.
+
+      The software is distributed in the hope that it will be useful, but
+           WITHOUT ANY WARRANTY; without even the implied warranty of
+       MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+                Lesser General Public License for more details.
+
+        You should have received a copy of the GNU Lesser General Public
+                 License along with the software.  If not, see
+                        <http://www.gnu.org/licenses/>.
+
+                 For information regarding this software email:
+                   "Joseph Coffland" <joseph@buildbotics.com>
+
+\******************************************************************************/
+
+
+#include "probe.h"
+
+#include "axis.h"
+#include "motor.h"
+#include "seek.h"
+#include "exec.h"
+#include "state.h"
+#include "command.h"
+#include "config.h"
+#include "util.h"
+#include "SCurve.h"
+
+#include <math.h>
+
+
+typedef enum {
+  PROBE_SEEK,    // Moving toward target, watching the switch
+  PROBE_DECEL,   // Switch found, stopping at max jerk
+  PROBE_RETRACT, // Backing off from the trigger position
+} probe_phase_t;
+
+
+typedef struct {
+  switch_id_t sw;
+  uint8_t flags;
+  float velocity;
+  float target[AXES];
+} probe_t;
+
+
+static struct {
+  float retract;
+  float slow_velocity;
+
+  probe_t cmd;
+  probe_phase_t phase;
+  bool slow;
+  bool found;
+
+  // Current leg
+  SCurve scurve;
+  float start[AXES];
+  float unit[AXES];
+  float length;
+  float dist;
+
+  float trigger[AXES];
+} pr = {0};
+
+
+static void _leg(const float target[], float velocity) {
+  exec_get_position(pr.start);
+
+  pr.length = 0;
+  for (int axis = 0; axis < AXES; axis++) {
+    pr.unit[axis] = target[axis] - pr.start[axis];
+    pr.length += square(pr.unit[axis]);
+  }
+
+  pr.length = sqrt(pr.length);
+  for (int axis = 0; axis < AXES; axis++)
+    if (pr.unit[axis]) pr.unit[axis] /= pr.length;
+
+  pr.dist = 0;
+  float maxV = axis_get_vector_limit(axis_get_velocity_max, pr.unit);
+  if (velocity < maxV) maxV = velocity;
+
+  pr.scurve = SCurve(maxV, axis_get_vector_limit(axis_get_accel_max, pr.unit),
+                     axis_get_vector_limit(axis_get_jerk_max, pr.unit));
+}
+
+
+static void _seek(float velocity) {
+  pr.phase = PROBE_SEEK;
+  _leg(pr.cmd.target, velocity);
+  seek_begin(pr.cmd.sw, pr.cmd.flags);
+}
+
+
+static void _retract() {
+  float target[AXES];
+  for (int axis = 0; axis < AXES; axis++)
+    target[axis] = pr.trigger[axis] - pr.unit[axis] * pr.retract;
+
+  pr.phase = PROBE_RETRACT;
+  _leg(target, pr.cmd.velocity);
+}
+
+
+/// Trigger position from the switch edge latch if there was one
+static void _found() {
+  exec_get_position(pr.trigger);
+
+  if (seek_latched())
+    for (int axis = 0; axis < AXES; axis++)
+      if (axis_is_enabled(axis))
+        pr.trigger[axis] = motor_get_latch(axis_get_motor(axis));
+
+  pr.found = true;
+  pr.phase = PROBE_DECEL;
+  seek_cancel();
+}
+
+
+static stat_t _done() {
+  command_reset_position();
+  exec_set_velocity(0);
+  exec_set_acceleration(0);
+  exec_set_jerk(0);
+  exec_set_cb(0);
+  seek_end(); // Errors if the switch was required but not found
+
+  // Let the host resync from the actual position
+  if (pr.found) state_seek_hold();
+
+  return STAT_AGAIN;
+}
+
+
+static stat_t _next_phase() {
+  if (state_get() == STATE_STOPPING) {
+    seek_cancel();
+    return _done();
+  }
+
+  switch (pr.phase) {
+  case PROBE_SEEK: return _done(); // Reached target
+
+  case PROBE_DECEL:
+    if (!pr.retract) return _done();
+    _retract();
+    return STAT_AGAIN;
+
+  case PROBE_RETRACT:
+    if (pr.slow || !pr.slow_velocity) return _done();
+    pr.slow = true;
+    pr.found = false;
+    _seek(pr.slow_velocity);
+    return STAT_AGAIN;
+  }
+
+  return _done();
+}
+
+
+stat_t probe_exec() {
+  // Check if the current leg is complete
+  if (pr.length <= pr.dist ||
+      (pr.phase == PROBE_DECEL && !pr.scurve.getVelocity()))
+    return _next_phase();
+
+  // Stop on pause or switch found, otherwise stop at the end of the leg
+  float targetV = pr.scurve.getMaxVelocity();
+  if (pr.phase == PROBE_DECEL || state_get() == STATE_STOPPING) targetV = 0;
+  else {
+    float dist = pr.scurve.getStoppingDist() *
+      (1 + (JOG_STOPPING_UNDERSHOOT / 100.0));
+    if (pr.length <= pr.dist + dist) targetV = MIN_VELOCITY;
+  }
+
+  // Compute next velocity
+  float v = pr.scurve.next(SEGMENT_TIME, targetV);
+  if (!v) return _next_phase(); // Stopped
+
+  // Don't overshoot the end of the leg
+  pr.dist += v * SEGMENT_TIME;
+  if (pr.length < pr.dist) pr.dist = pr.length;
+
+  float target[AXES];
+  for (int axis = 0; axis < AXES; axis++)
+    target[axis] = pr.start[axis] + pr.unit[axis] * pr.dist;
+
+  exec_set_velocity(v);
+  exec_set_acceleration(pr.scurve.getAcceleration());
+  exec_set_jerk(pr.scurve.getJerk());
+  exec_move_to_target(target);
+
+  if (pr.phase == PROBE_SEEK && seek_switch_found()) _found();
+
+  return STAT_OK;
+}
+
+
+// Var callbacks
+float get_probe_retract() {return pr.retract;}
+void set_probe_retract(float value) {pr.retract = value;}
+
+
+float get_probe_slow() {return pr.slow_velocity / VELOCITY_MULTIPLIER;}
+
+
+void set_probe_slow(float value) {
+  pr.slow_velocity = value * VELOCITY_MULTIPLIER;
+}
+
+
+float get_probe_position(int axis) {return pr.trigger[axis];}
+
+
+// Command callbacks
+stat_t command_probe(char *cmd) {
+  probe_t probe;
+
+  probe.sw = (switch_id_t)decode_hex_nibble(cmd[1]);
+  probe.flags = decode_hex_nibble(cmd[2]);
+  stat_t status = seek_validate(probe.sw, probe.flags);
+  if (status) return status;
+  cmd += 3;
+
+  // Get velocity
+  if (!decode_float(&cmd, &probe.velocity)) return STAT_BAD_FLOAT;
+  if (probe.velocity <= 0) return STAT_INVALID_ARGUMENTS;
+
+  // Get target position
+  command_get_position(probe.target);
+  status = decode_axes(&cmd, probe.target);
+  if (status) return status;
+
+  // Check for end of command
+  if (*cmd) return STAT_INVALID_ARGUMENTS;
+
+  // Set next start position, updated again when the probe is done
+  command_set_position(probe.target);
+
+  // Queue
+  command_push(COMMAND_probe, &probe);
+
+  return STAT_OK;
+}
+
+
+unsigned command_probe_size() {return sizeof(probe_t);}
+
+
+void command_probe_exec(void *data) {
+  pr.cmd = *(probe_t *)data;
+  pr.slow = pr.found = false;
+  _seek(pr.cmd.velocity);
+  exec_set_cb(probe_exec);
+}
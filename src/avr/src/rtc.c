@@ -28,8 +28,8 @@
 #include "rtc.h"
 
 #include "switch.h"
-#include "analog.h"
 #include "motor.h"
+#include "drv8711.h"
 #include "lcd.h"
 #include "vfd_spindle.h"
 
@@ -48,8 +48,8 @@ ISR(RTC_OVF_vect) {
 
   lcd_rtc_callback();
   switch_rtc_callback();
-  analog_rtc_callback();
   vfd_spindle_rtc_callback();
+  drv8711_rtc_callback();
   if (!(ticks & 255)) motor_rtc_callback();
   wdt_reset();
 }
@@ -32,6 +32,9 @@
 #include "estop.h"
 #include "util.h"
 #include "state.h"
+#include "exec.h"
+#include "drv8711.h"
+#include "motor.h"
 
 #include <stdint.h>
 
@@ -51,17 +54,37 @@ typedef struct {
 
 
 static seek_t seek = {false, SW_INVALID, 0};
+static bool latched = false;
+
+
+static bool _is_stall_switch(switch_id_t sw) {
+  return SW_STALL_0 <= sw && sw <= SW_STALL_3;
+}
 
 
 switch_id_t seek_get_switch() {return seek.active ? seek.sw : SW_INVALID;}
 
 
+stat_t seek_validate(switch_id_t sw, uint8_t flags) {
+  if (sw <= 0) return STAT_INVALID_ARGUMENTS; // Don't allow seek to ESTOP
+  if (!switch_is_enabled(sw)) return STAT_SEEK_NOT_ENABLED;
+  if (_is_stall_switch(sw) && !drv8711_stall_enabled(sw - SW_STALL_0))
+    return STAT_SEEK_NOT_ENABLED;
+  if (flags & 0xfc) return STAT_INVALID_ARGUMENTS;
+
+  return STAT_OK;
+}
+
+
 bool seek_switch_found() {
   if (!seek.active) return false;
 
+  // Back EMF is too low for stall detection until at seek velocity
+  if (_is_stall_switch(seek.sw) && exec_get_acceleration()) return false;
+
   bool inactive = !(seek.flags & SEEK_ACTIVE);
 
-  if (switch_is_active(seek.sw) ^ inactive) {
+  if (latched || (switch_is_active(seek.sw) ^ inactive)) {
     seek.flags |= SEEK_FOUND;
     return true;
   }
@@ -70,27 +93,51 @@ bool seek_switch_found() {
 }
 
 
+bool seek_latched() {return latched;}
+
+
 void seek_end() {
   if (!seek.active) return;
 
   if (!(SEEK_FOUND & seek.flags) && (SEEK_ERROR & seek.flags))
     estop_trigger(STAT_SEEK_NOT_FOUND);
 
+  switch_capture_cancel();
   seek.active = false;
 }
 
 
-void seek_cancel() {seek.active = false;}
+void seek_cancel() {
+  switch_capture_cancel();
+  seek.active = false;
+}
+
+
+static void _latch(switch_id_t sw, bool active) {
+  for (int motor = 0; motor < MOTORS; motor++)
+    motor_latch(motor);
+
+  latched = true;
+}
+
+
+void seek_begin(switch_id_t sw, uint8_t flags) {
+  seek.active = true;
+  seek.sw = sw;
+  seek.flags = flags;
+
+  // Latch motor positions on the switch edge if the input supports it
+  latched = false;
+  if (!_is_stall_switch(sw)) switch_capture(sw, flags & SEEK_ACTIVE, _latch);
+}
 
 
 // Command callbacks
 stat_t command_seek(char *cmd) {
   switch_id_t sw = (switch_id_t)decode_hex_nibble(cmd[1]);
-  if (sw <= 0) return STAT_INVALID_ARGUMENTS; // Don't allow seek to ESTOP
-  if (!switch_is_enabled(sw)) return STAT_SEEK_NOT_ENABLED;
-
   uint8_t flags = decode_hex_nibble(cmd[2]);
-  if (flags & 0xfc) return STAT_INVALID_ARGUMENTS;
+  stat_t status = seek_validate(sw, flags);
+  if (status) return status;
 
   seek_t seek = {true, sw, flags};
   command_push(*cmd, &seek);
@@ -100,4 +147,13 @@ stat_t command_seek(char *cmd) {
 
 
 unsigned command_seek_size() {return sizeof(seek_t);}
-void command_seek_exec(void *data) {seek = *(seek_t *)data;}
+
+
+void command_seek_exec(void *data) {
+  seek_t *cmd = (seek_t *)data;
+  seek_begin(cmd->sw, cmd->flags);
+}
+
+
+// Var callbacks
+bool get_latched() {return latched;}
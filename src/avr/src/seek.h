@@ -28,11 +28,15 @@
 #pragma once
 
 #include "switch.h"
+#include "status.h"
 
 #include <stdbool.h>
 
 
 switch_id_t seek_get_switch();
+stat_t seek_validate(switch_id_t sw, uint8_t flags);
+void seek_begin(switch_id_t sw, uint8_t flags);
 bool seek_switch_found();
+bool seek_latched();
 void seek_end();
 void seek_cancel();
@@ -143,12 +143,12 @@ static void _set_type(spindle_type_t type) {
 spindle_type_t spindle_get_type() {return spindle.type;}
 
 
-static power_update_t _get_power_update() {
+static power_update_t _get_power_update(float velocity) {
   float power = _speed_to_power(spindle.speed);
 
   // Handle dynamic power
   if (spindle.dynamic_power && spindle.inv_feed) {
-    float scale = spindle.inv_feed * exec_get_velocity();
+    float scale = spindle.inv_feed * velocity;
     if (scale < 1) power *= scale;
   }
 
@@ -156,8 +156,10 @@ static power_update_t _get_power_update() {
 }
 
 
+/// @param vel velocity at each power update step or null to use the
+/// current exec velocity for all steps.
 void spindle_load_power_updates(power_update_t updates[], float minD,
-                                float maxD) {
+                                float maxD, const float vel[]) {
   float stepD = (maxD - minD) * (1.0 / POWER_MAX_UPDATES);
   float d = minD + 1e-3; // Starting distance
 
@@ -179,7 +181,8 @@ void spindle_load_power_updates(power_update_t updates[], float minD,
       changed = true;
     }
 
-    if (spindle.type == SPINDLE_TYPE_PWM) updates[i] = _get_power_update();
+    if (spindle.type == SPINDLE_TYPE_PWM)
+      updates[i] = _get_power_update(vel ? vel[i] : exec_get_velocity());
     else {
       updates[i].state = POWER_IGNORE;
       if (changed) spindle_update_speed();
@@ -199,7 +202,8 @@ void spindle_idle() {
     spindle.sync_speed.dist = -1; // Mark done
     spindle.speed = spindle.sync_speed.speed;
 
-    if (spindle.type == SPINDLE_TYPE_PWM) spindle_update(_get_power_update());
+    if (spindle.type == SPINDLE_TYPE_PWM)
+      spindle_update(_get_power_update(exec_get_velocity()));
     else spindle_update_speed();
   }
 }
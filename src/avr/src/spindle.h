@@ -67,7 +67,7 @@ spindle_type_t spindle_get_type();
 void spindle_stop();
 void spindle_estop();
 void spindle_load_power_updates(power_update_t updates[], float minD,
-                                float maxD);
+                                float maxD, const float vel[]);
 void spindle_update(const power_update_t &update);
 void spindle_update_speed();
 void spindle_idle();
@@ -45,6 +45,8 @@ static struct {
   bool stop_requested;
   bool pause_requested;
   bool unpause_requested;
+  bool error_hold_requested;
+  bool error_estop_requested;
 
   state_t state;
   uint16_t state_count;
@@ -75,6 +77,7 @@ PGM_P state_get_hold_reason_pgmstr(hold_reason_t reason) {
   case HOLD_REASON_PROGRAM_PAUSE:  return PSTR("Program pause");
   case HOLD_REASON_OPTIONAL_PAUSE: return PSTR("Optional pause");
   case HOLD_REASON_SWITCH_FOUND:   return PSTR("Switch found");
+  case HOLD_REASON_FOLLOWING_ERROR: return PSTR("Following error");
   }
 
   return PSTR("INVALID");
@@ -111,6 +114,10 @@ void state_seek_hold() {
 }
 
 
+void state_error_hold() {s.error_hold_requested = true;}
+void state_error_estop() {s.error_estop_requested = true;}
+
+
 static void _stop() {
   _set_hold_reason(HOLD_REASON_USER_STOP);
 
@@ -162,6 +169,12 @@ void state_estop() {_set_state(STATE_ESTOPPED);}
 
 
 void state_callback() {
+  // Following error estop, requested from the step timer interrupt
+  if (s.error_estop_requested) {
+    s.error_estop_requested = false;
+    estop_trigger(STAT_FOLLOWING_ERROR);
+  }
+
   if (estop_triggered()) return;
 
   // Pause
@@ -174,6 +187,16 @@ void state_callback() {
     s.pause_requested = false;
   }
 
+  // Following error
+  if (s.error_hold_requested) {
+    if (state_get() == STATE_RUNNING) {
+      _set_hold_reason(HOLD_REASON_FOLLOWING_ERROR);
+      _set_state(STATE_STOPPING);
+    }
+
+    s.error_hold_requested = false;
+  }
+
   // Stop
   if (s.stop_requested) {
     _stop();
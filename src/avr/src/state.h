@@ -48,6 +48,7 @@ typedef enum {
   HOLD_REASON_PROGRAM_PAUSE,
   HOLD_REASON_OPTIONAL_PAUSE,
   HOLD_REASON_SWITCH_FOUND,
+  HOLD_REASON_FOLLOWING_ERROR,
 } hold_reason_t;
 
 
@@ -67,6 +68,8 @@ bool state_is_flushing();
 bool state_is_resuming();
 
 void state_seek_hold();
+void state_error_hold();
+void state_error_estop();
 void state_holding();
 void state_running();
 void state_jogging();
@@ -230,7 +230,7 @@ void st_prep_dwell(float seconds) {
   ESTOP_ASSERT(!st.move_ready, STAT_STEPPER_NOT_READY);
   if (seconds <= 1e-4) seconds = 1e-4; // Min dwell
   st.power_next = !st.power_buf;
-  spindle_load_power_updates(st.powers[st.power_next], 0, 0);
+  spindle_load_power_updates(st.powers[st.power_next], 0, 0, 0);
   st.prep_dwell = seconds;
   st.move_queued = true; // signal prep buffer ready
 }
@@ -28,6 +28,9 @@
 #include "switch.h"
 #include "config.h"
 
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
 #include <stdbool.h>
 #include <stdio.h>
 
@@ -49,6 +52,7 @@ typedef struct {
   uint16_t debounce;
   uint16_t lockout;
   bool initialized;
+  uint8_t edges[2]; // Inactive and active edge counts
 } switch_t;
 
 
@@ -75,6 +79,14 @@ static switch_t switches[] = {
 static const int num_switches = sizeof(switches) / sizeof (switch_t);
 
 
+static struct {
+  switch_id_t sw;
+  bool active;
+  bool level;
+  switch_callback_t cb;
+} capture = {SW_INVALID};
+
+
 void switch_init() {
   for (int i = 0; i < num_switches; i++) {
     switch_t *s = &switches[i];
@@ -100,12 +112,83 @@ void switch_rtc_callback() {
       s->debounce = 0;
       s->initialized = true;
       s->lockout = sw.lockout;
-      if (s->cb) s->cb((switch_id_t)i, switch_is_active((switch_id_t)i));
+
+      bool active = switch_is_active((switch_id_t)i);
+      s->edges[active]++;
+      if (s->cb) s->cb((switch_id_t)i, active);
     }
   }
 }
 
 
+static bool _can_capture(switch_id_t sw) {
+  PORT_t *port = PIN_PORT(switches[sw].pin);
+  return port == &PORTB || port == &PORTF;
+}
+
+
+static void _capture_disable() {
+  if (capture.sw == SW_INVALID) return;
+
+  PORT_t *port = PIN_PORT(switches[capture.sw].pin);
+  port->INTCTRL &= ~PORT_INT0LVL_gm;
+  port->INT0MASK = 0;
+  capture.sw = SW_INVALID;
+}
+
+
+static void _capture_isr(PORT_t *port) {
+  if (capture.sw == SW_INVALID) return;
+
+  uint8_t pin = switches[capture.sw].pin;
+  if (PIN_PORT(pin) != port || IN_PIN(pin) != capture.level) return;
+
+  // Trigger once, the first edge is the one that matters
+  switch_id_t sw = capture.sw;
+  _capture_disable();
+  capture.cb(sw, capture.active);
+}
+
+
+ISR(PROBE_ISR_vect) {_capture_isr(&PORTF);}
+ISR(LIMIT_ISR_vect) {_capture_isr(&PORTB);}
+
+
+/// Call @param cb from interrupt on the first raw edge of @param sw into the
+/// requested state.  Unlike the polled state this is not debounced.
+bool switch_capture(switch_id_t sw, bool active, switch_callback_t cb) {
+  switch_capture_cancel();
+
+  if (!switch_is_enabled(sw) || !_can_capture(sw)) return false;
+
+  // NOTE, switch inputs are active lo
+  switch_t *s = &switches[sw];
+  bool level = (s->type == SW_NORMALLY_CLOSED) ^ !active;
+  PORT_t *port = PIN_PORT(s->pin);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    capture.sw = sw;
+    capture.active = active;
+    capture.level = level;
+    capture.cb = cb;
+
+    port->INT0MASK = PIN_BM(s->pin);
+    port->INTFLAGS = PORT_INT0IF_bm;
+    port->INTCTRL = (port->INTCTRL & ~PORT_INT0LVL_gm) | PORT_INT0LVL_HI_gc;
+
+    // Already there
+    if (IN_PIN(s->pin) == level) _capture_isr(port);
+  }
+
+  return true;
+}
+
+
+void switch_capture_cancel() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) _capture_disable();
+}
+
+
 bool switch_is_active(switch_id_t sw) {
   if (sw < 0 || num_switches <= sw || !switches[sw].initialized) return false;
 
@@ -120,6 +203,13 @@ bool switch_is_active(switch_id_t sw) {
 }
 
 
+/// Count of debounced edges to the given state, wraps
+uint8_t switch_get_edges(switch_id_t sw, bool active) {
+  if (sw < 0 || num_switches <= sw) return 0;
+  return switches[sw].edges[active];
+}
+
+
 bool switch_is_enabled(switch_id_t sw) {
   return switch_get_type(sw) != SW_DISABLED;
 }
@@ -67,6 +67,9 @@ void switch_init();
 void switch_rtc_callback();
 bool switch_is_active(switch_id_t sw);
 bool switch_is_enabled(switch_id_t sw);
+uint8_t switch_get_edges(switch_id_t sw, bool active);
 switch_type_t switch_get_type(switch_id_t sw);
 void switch_set_type(switch_id_t sw, switch_type_t type);
 void switch_set_callback(switch_id_t sw, switch_callback_t cb);
+bool switch_capture(switch_id_t sw, bool active, switch_callback_t cb);
+void switch_capture_cancel();
@@ -39,36 +39,13 @@
 #include <stdint.h>
 
 
-typedef enum {
-  REG_DISABLED,
-
-  REG_CONNECT_WRITE,
-
-  REG_MAX_FREQ_READ,
-  REG_MAX_FREQ_FIXED,
-
-  REG_FREQ_SET,
-  REG_FREQ_SIGN_SET,
-
-  REG_STOP_WRITE,
-  REG_FWD_WRITE,
-  REG_REV_WRITE,
-
-  REG_FREQ_READ,
-  REG_FREQ_SIGN_READ,
-  REG_FREQ_ACTECH_READ,
-
-  REG_STATUS_READ,
-
-  REG_DISCONNECT_WRITE,
-} vfd_reg_type_t;
-
-
 typedef struct {
   vfd_reg_type_t type;
   uint16_t addr;
   uint16_t value;
   uint8_t fails;
+  uint8_t id;      // Slave ID, zero for the spindle's bus ID
+  uint16_t period; // Poll period in ms, zero for VFD_QUERY_DELAY
 } vfd_reg_t;
 
 
@@ -174,7 +151,13 @@ static vfd_reg_t custom_regs[VFDREG];
 static struct {
   vfd_reg_type_t state;
   int8_t reg;
-  uint8_t read_count;
+  uint32_t poll;       // Regs remaining to be polled, one bit per reg
+  uint32_t reading;    // Regs covered by the current poll read
+  uint16_t poll_due[VFDREG];
+  uint16_t reads[VFDREG]; // Last value read from each reg
+  uint16_t read_addr;
+  uint8_t read_words;
+  bool no_coalesce;
   bool changed;
   bool shutdown;
 
@@ -196,6 +179,104 @@ static void _disconnected() {
 }
 
 
+static uint32_t _reg_bit(int reg) {return (uint32_t)1 << reg;}
+
+
+static bool _is_poll_reg(vfd_reg_type_t type) {
+  switch (type) {
+  case REG_FREQ_READ: case REG_FREQ_SIGN_READ: case REG_FREQ_ACTECH_READ:
+  case REG_STATUS_READ: return true;
+  default: return false;
+  }
+}
+
+
+static uint8_t _reg_words(vfd_reg_type_t type) {
+  return type == REG_FREQ_ACTECH_READ ? 6 : 1;
+}
+
+
+static uint16_t _reg_value_addr(const vfd_reg_t &reg) {
+  // AC Tech actual frequency is the second of the six words read
+  return reg.addr + (reg.type == REG_FREQ_ACTECH_READ ? 1 : 0);
+}
+
+
+static void _modbus_cb(bool ok, uint16_t addr, uint16_t value);
+
+
+static uint16_t _poll_period(int reg) {
+  return regs[reg].period ? regs[reg].period : VFD_QUERY_DELAY;
+}
+
+
+static int16_t _poll_remaining(int reg) {
+  return vfd.poll_due[reg] - (uint16_t)rtc_get_time();
+}
+
+
+/// Schedule all status reads which are due or, if @param all, every status
+/// read.  Each reg is polled at its own period.
+static void _poll_start(bool all) {
+  vfd.poll = 0;
+
+  for (int i = 0; i < VFDREG; i++)
+    if (_is_poll_reg(regs[i].type) && (all || _poll_remaining(i) <= 0)) {
+      vfd.poll |= _reg_bit(i);
+      vfd.poll_due[i] = rtc_get_time() + _poll_period(i);
+    }
+}
+
+
+static void _poll_wait() {
+  int16_t delay = VFD_QUERY_DELAY;
+
+  for (int i = 0; i < VFDREG; i++)
+    if (_is_poll_reg(regs[i].type) && _poll_remaining(i) < delay)
+      delay = _poll_remaining(i);
+
+  vfd.wait = rtc_get_time() + (delay < 1 ? 1 : delay);
+}
+
+
+/// Issue the next status read.  Regs of the same slave whose addresses fall
+/// within VFD_MAX_READ_WORDS of each other are coalesced in to a single read.
+static bool _poll() {
+  // Pending speed changes take priority over status polling
+  if (vfd.changed || vfd.shutdown) vfd.poll = 0;
+  if (!vfd.poll) return false;
+
+  int first = 0;
+  while (!(vfd.poll & _reg_bit(first))) first++;
+
+  uint32_t lo = regs[first].addr;
+  uint32_t hi = lo + _reg_words(regs[first].type);
+  vfd.reading = _reg_bit(first);
+
+  for (int i = first + 1; i < VFDREG && !vfd.no_coalesce; i++) {
+    if (!(vfd.poll & _reg_bit(i)) || regs[i].id != regs[first].id) continue;
+
+    uint32_t start = regs[i].addr;
+    uint32_t end = start + _reg_words(regs[i].type);
+    if (lo < start) start = lo;
+    if (end < hi) end = hi;
+
+    if (end - start <= VFD_MAX_READ_WORDS) {
+      lo = start;
+      hi = end;
+      vfd.reading |= _reg_bit(i);
+    }
+  }
+
+  vfd.poll &= ~vfd.reading;
+  vfd.read_addr = lo;
+  vfd.read_words = hi - lo;
+  modbus_read(regs[first].id, vfd.read_addr, vfd.read_words, _modbus_cb);
+
+  return true;
+}
+
+
 static bool _next_state() {
   switch (vfd.state) {
   case REG_MAX_FREQ_FIXED:
@@ -210,21 +291,22 @@ static bool _next_state() {
     break;
 
   case REG_STOP_WRITE: case REG_FWD_WRITE: case REG_REV_WRITE:
+    // All status reads are polled while in the REG_FREQ_READ state
     vfd.state = REG_FREQ_READ;
+    _poll_start(true);
     break;
 
-  case REG_STATUS_READ:
+  case REG_FREQ_READ:
     if (vfd.shutdown || estop_triggered()) vfd.state = REG_DISCONNECT_WRITE;
 
     else if (vfd.changed) {
-      // Update frequency and state
+      // Update frequency and state.  Max frequency is only reread if unknown.
       vfd.changed = false;
-      vfd.state = REG_MAX_FREQ_READ;
+      vfd.state = vfd.max_freq ? REG_MAX_FREQ_FIXED : REG_MAX_FREQ_READ;
 
     } else {
-      // Continue querying after delay
-      vfd.state = REG_FREQ_READ;
-      vfd.wait = rtc_get_time() + VFD_QUERY_DELAY;
+      // Continue querying when the next reg is due
+      _poll_wait();
       return false;
     }
     break;
@@ -246,11 +328,15 @@ static bool _exec_command();
 
 static void _next_reg() {
   while (true) {
+    if (vfd.state == REG_FREQ_READ) {
+      if (_poll() || !_next_state()) break;
+      continue;
+    }
+
     vfd.reg++;
 
     if (vfd.reg == VFDREG) {
       vfd.reg = -1;
-      vfd.read_count = 0;
       if (!_next_state()) break;
 
     } else if (regs[vfd.reg].type == vfd.state && _exec_command()) break;
@@ -265,35 +351,75 @@ static void _connect() {
 }
 
 
-static void _modbus_cb(bool ok, uint16_t addr, uint16_t value) {
-  // Handle error
-  if (!ok) {
-    if (regs[vfd.reg].fails < 255) regs[vfd.reg].fails++;
-    if (vfd.shutdown || estop_triggered()) _disconnected();
-    else _connect();
-    return;
-  }
+static void _reg_fail(int reg) {
+  if (regs[reg].fails < 255) regs[reg].fails++;
+}
 
-  // Handle read result
-  vfd.read_count++;
 
-  switch (regs[vfd.reg].type) {
+static void _read_value(int reg, uint16_t value) {
+  // Record the last value read from every read reg
+  if (_is_poll_reg(regs[reg].type) || regs[reg].type == REG_MAX_FREQ_READ)
+    vfd.reads[reg] = value;
+
+  // Only the spindle drive's regs control the spindle state
+  if (regs[reg].id) return;
+
+  switch (regs[reg].type) {
   case REG_MAX_FREQ_READ: vfd.max_freq = value; break;
-  case REG_FREQ_READ: vfd.actual_power = value / (float)vfd.max_freq; break;
 
-  case REG_FREQ_SIGN_READ:
-    vfd.actual_power = (int16_t)value / (float)vfd.max_freq;
+  case REG_FREQ_READ: case REG_FREQ_ACTECH_READ:
+    vfd.actual_power = value / (float)vfd.max_freq;
     break;
 
-  case REG_FREQ_ACTECH_READ:
-    if (vfd.read_count == 2) vfd.actual_power = value / (float)vfd.max_freq;
-    if (vfd.read_count < 6) return;
+  case REG_FREQ_SIGN_READ:
+    vfd.actual_power = (int16_t)value / (float)vfd.max_freq;
     break;
 
   case REG_STATUS_READ: vfd.status = value; break;
 
   default: break;
   }
+}
+
+
+static void _modbus_cb(bool ok, uint16_t addr, uint16_t value) {
+  // Handle error
+  if (!ok) {
+    uint8_t id = 0;
+
+    if (vfd.reading) {
+      for (int i = 0; i < VFDREG; i++)
+        if (vfd.reading & _reg_bit(i)) {
+          _reg_fail(i);
+          id = regs[i].id; // Coalesced reads never span slaves
+        }
+
+      // Some drives reject reads which span unmapped registers
+      if (vfd.reading & (vfd.reading - 1)) vfd.no_coalesce = true;
+      vfd.reading = 0;
+
+    } else {
+      _reg_fail(vfd.reg);
+      id = regs[vfd.reg].id;
+    }
+
+    if (vfd.shutdown || estop_triggered()) _disconnected();
+    else if (id) _next_reg(); // Auxiliary device, don't disturb the spindle
+    else _connect();
+    return;
+  }
+
+  // Handle read result
+  if (vfd.reading) {
+    for (int i = 0; i < VFDREG; i++)
+      if ((vfd.reading & _reg_bit(i)) && _reg_value_addr(regs[i]) == addr)
+        _read_value(i, value);
+
+    // Wait for the rest of the words
+    if (addr != vfd.read_addr + vfd.read_words - 1) return;
+    vfd.reading = 0;
+
+  } else _read_value(vfd.reg, value);
 
   // Next
   _next_reg();
@@ -313,7 +439,6 @@ static bool _exec_command() {
   if (vfd.wait) return true;
 
   vfd_reg_t reg = regs[vfd.reg];
-  uint16_t words = 1;
   bool read = false;
   bool write = false;
 
@@ -340,20 +465,16 @@ static bool _exec_command() {
     write = true;
     break;
 
-  case REG_FREQ_ACTECH_READ:
-    words = 6;
-
-  case REG_FREQ_READ:
-  case REG_FREQ_SIGN_READ:
   case REG_MAX_FREQ_READ:
-  case REG_STATUS_READ:
     read = true;
     break;
+
+  default: break; // Status reads are handled by _poll()
   }
 
-  if (read) modbus_read(reg.addr, words, _modbus_cb);
+  if (read) modbus_read(reg.id, reg.addr, 1, _modbus_cb);
   else if (write) (_use_multi_write() ? modbus_multi_write : modbus_write)
-                    (reg.addr, reg.value, _modbus_cb);
+                    (reg.id, reg.addr, reg.value, _modbus_cb);
   else return false;
 
   return true;
@@ -368,6 +489,8 @@ static void _load(const vfd_reg_t *_regs) {
     if (!regs[i].type) break;
     regs[i].addr = pgm_read_word(&_regs[i].addr);
     regs[i].value = pgm_read_word(&_regs[i].value);
+    regs[i].id = pgm_read_byte(&_regs[i].id);
+    regs[i].period = pgm_read_word(&_regs[i].period);
   }
 }
 
@@ -389,6 +512,8 @@ void vfd_spindle_init() {
   default: break;
   }
 
+  for (int i = 0; i < VFDREG; i++) vfd.poll_due[i] = rtc_get_time();
+
   _connect();
 }
 
@@ -413,8 +538,15 @@ uint16_t vfd_get_status() {return vfd.status;}
 
 
 void vfd_spindle_rtc_callback() {
-  if (!vfd.wait || !rtc_expired(vfd.wait)) return;
+  if (!vfd.wait) return;
+
+  // Speed changes and shutdown cut the query delay short.  Only reschedule
+  // status reads when the delay actually ran out.
+  bool expired = rtc_expired(vfd.wait);
+  if (!(expired || vfd.changed || vfd.shutdown)) return;
+
   vfd.wait = 0;
+  if (expired) _poll_start(false);
   _next_reg();
 }
 
@@ -458,8 +590,28 @@ void set_vfd_reg_val(int reg, uint16_t value) {
 
 
 uint8_t get_vfd_reg_fails(int reg) {return regs[reg].fails;}
+uint16_t get_vfd_reg_read(int reg) {return vfd.reads[reg];}
 
 
 void set_vfd_reg_fails(int reg, uint8_t value) {
   regs[reg].fails = value;
 }
+
+
+uint8_t get_vfd_reg_id(int reg) {return regs[reg].id;}
+
+
+void set_vfd_reg_id(int reg, uint8_t id) {
+  custom_regs[reg].id = id;
+  if (spindle_get_type() == SPINDLE_TYPE_CUSTOM) regs[reg].id = id;
+  vfd.changed = true;
+}
+
+
+uint16_t get_vfd_reg_period(int reg) {return regs[reg].period;}
+
+
+void set_vfd_reg_period(int reg, uint16_t period) {
+  custom_regs[reg].period = period;
+  if (spindle_get_type() == SPINDLE_TYPE_CUSTOM) regs[reg].period = period;
+}
@@ -30,6 +30,31 @@
 #include "spindle.h"
 
 
+typedef enum {
+  REG_DISABLED,
+
+  REG_CONNECT_WRITE,
+
+  REG_MAX_FREQ_READ,
+  REG_MAX_FREQ_FIXED,
+
+  REG_FREQ_SET,
+  REG_FREQ_SIGN_SET,
+
+  REG_STOP_WRITE,
+  REG_FWD_WRITE,
+  REG_REV_WRITE,
+
+  REG_FREQ_READ,
+  REG_FREQ_SIGN_READ,
+  REG_FREQ_ACTECH_READ,
+
+  REG_STATUS_READ,
+
+  REG_DISCONNECT_WRITE,
+} vfd_reg_type_t;
+
+
 void vfd_spindle_init();
 void vfd_spindle_deinit(deinit_cb_t cb);
 void vfd_spindle_set(float power);
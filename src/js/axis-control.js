@@ -30,15 +30,22 @@
 
 module.exports = {
   template: '#axis-control-template',
-  props: ['axes', 'colors', 'enabled', 'adjust'],
+  props: ['axes', 'colors', 'enabled', 'adjust', 'step'],
 
 
   methods: {
     jog: function (axis, power) {
-      this.$dispatch('jog', this.axes[axis], power * this.adjust / 100.0)
+      if (this.step)
+        this.$dispatch('jog_step', this.axes[axis],
+                       power < 0 ? -this.step : this.step,
+                       Math.abs(power) * this.adjust / 100.0)
+
+      else this.$dispatch('jog', this.axes[axis], power * this.adjust / 100.0)
     },
 
 
-    release: function (axis) {this.$dispatch('jog', this.axes[axis], 0)}
+    release: function (axis) {
+      if (!this.step) this.$dispatch('jog', this.axes[axis], 0)
+    }
   }
 }
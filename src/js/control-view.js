@@ -50,6 +50,7 @@ module.exports = {
     return {
       mach_units: 'METRIC',
       mdi: '',
+      start_line: 1,
       last_file: undefined,
       last_file_time: undefined,
       toolpath: {},
@@ -63,6 +64,7 @@ module.exports = {
       {x: false, y: false, z: false, a: false, b: false, c: false},
       axis_position: 0,
       jog_adjust: 100,
+      jog_step: 0,
       deleteGCode: false,
       tab: 'auto'
     }
@@ -105,6 +107,11 @@ module.exports = {
     metric: function () {return !this.state.imperial},
 
 
+    jog_steps: function () {
+      return this.metric ? [0.1, 1, 10] : [0.01, 0.1, 1];
+    },
+
+
     mach_state: function () {
       var cycle = this.state.cycle;
       var state = this.state.xx;
@@ -192,6 +199,14 @@ module.exports = {
       var data = {ts: new Date().getTime()};
       data[axis] = power;
       api.put('jog', data);
+    },
+
+
+    jog_step: function (axis, distance, velocity) {
+      var data = {ts: new Date().getTime(), mode: 'incremental',
+                  velocity: velocity};
+      data[axis] = distance * (this.metric ? 1 : 25.4);
+      api.put('jog', data);
     }
   },
 
@@ -364,6 +379,7 @@ module.exports = {
 
 
     start: function () {api.put('start')},
+    start_at: function () {api.put('start', {line: this.start_line})},
     pause: function () {api.put('pause')},
     unpause: function () {api.put('unpause')},
     optional_pause: function () {api.put('pause/optional')},
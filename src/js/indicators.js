@@ -29,6 +29,9 @@
 
 var modbus = require('./modbus.js');
 
+// Must match ERRHIST_LABEL in avr/src/vars.def
+var error_hist_label = '0123456789abcdefghijklmnopqrstuv';
+
 
 module.exports = {
   template: '#indicators-template',
@@ -39,6 +42,11 @@ module.exports = {
     modbus_status: function () {return modbus.status_to_string(this.state.mx)},
 
 
+    error_bins: function () {
+      return ['0', '1', '2-3', '4-7', '8-15', '16-31', '32-63', '64+'];
+    },
+
+
     sense_error: function () {
       var error = '';
 
@@ -102,6 +110,25 @@ module.exports = {
         this.$dispatch('send', cmd);
 
       } else this.$dispatch('send', '\\$' + motor + 'df=0');
+    },
+
+
+    get_error_hist: function (motor, bin) {
+      var count = this.state[error_hist_label[motor * 8 + bin] + 'eh'];
+      return typeof count == 'undefined' ? 0 : count;
+    },
+
+
+    error_reset: function (motor) {
+      if (typeof motor == 'undefined') {
+        for (var i = 0; i < 4; i++) this.error_reset(i);
+        return;
+      }
+
+      var cmd = '\\$' + motor + 'cs=0\n';
+      for (var bin = 0; bin < 8; bin++)
+        cmd += '\\$' + error_hist_label[motor * 8 + bin] + 'eh=0\n';
+      this.$dispatch('send', cmd);
     }
   }
 }
@@ -38,6 +38,12 @@ module.exports = {
     has_user_value: function () {
       var type = this.model['reg-type'];
       return type.indexOf('write') != -1 || type.indexOf('fixed') != -1;
+    },
+
+
+    is_polled: function () {
+      var type = this.model['reg-type'];
+      return type.indexOf('read') != -1 && type != 'max-freq-read';
     }
   },
 
@@ -34,7 +34,8 @@ var exports = {
   OK:           1,
   CRC:          2,
   INVALID:      3,
-  TIMEDOUT:     4
+  TIMEDOUT:     4,
+  EXCEPTION:    5
 };
 
 
@@ -44,6 +45,7 @@ exports.status_to_string =
     if (status == exports.CRC)      return 'CRC error';
     if (status == exports.INVALID)  return 'Invalid response';
     if (status == exports.TIMEDOUT) return 'Timedout';
+    if (status == exports.EXCEPTION) return 'Exception response';
     return 'Disconnected';
   }
 
@@ -27,6 +27,8 @@
 
 'use strict'
 
+var api = require('./api');
+
 
 module.exports = {
   template: '#motor-view-template',
@@ -79,7 +81,12 @@ module.exports = {
     },
 
 
-    milPerStep: function () {return this.umPerStep / 25.4}
+    milPerStep: function () {return this.umPerStep / 25.4},
+
+
+    stallHoming: function () {
+      return String(this.motor['homing-mode']).indexOf('stall-') == 0;
+    }
   },
 
 
@@ -95,5 +102,12 @@ module.exports = {
 
       return false;
     }
+  },
+
+
+  methods: {
+    calibrate_stall: function () {
+      api.put('home/' + this.motor.axis.toLowerCase() + '/stall-calibrate');
+    }
   }
 }
@@ -28,6 +28,7 @@
 var orbit = require('./orbit');
 var cookie = require('./cookie')('bbctrl-');
 var api = require('./api');
+var toolpath = require('./toolpath');
 var font = require('./helvetiker_regular.typeface.json')
 
 
@@ -134,15 +135,19 @@ module.exports = {
 
       if (!this.enabled || !this.toolpath.filename) return;
 
-      function get(url) {
+      var url = '/api/path/' + this.toolpath.filename + '/path';
+      var loadID = this.loadID = Math.random();
+
+      function get_range(start, end) {
         var d = $.Deferred();
         var xhr = new XMLHttpRequest();
 
-        xhr.open('GET', url + '?' + Math.random(), true);
+        xhr.open('GET', url + '?' + loadID, true);
+        xhr.setRequestHeader('Range', 'bytes=' + start + '-' + (end - 1));
         xhr.responseType = 'arraybuffer';
 
         xhr.onload = function (e) {
-          if (xhr.response) d.resolve(new Float32Array(xhr.response));
+          if (xhr.response) d.resolve(xhr.response);
           else d.reject();
         };
 
@@ -151,20 +156,80 @@ module.exports = {
         return d.promise();
       }
 
-      var d1 = get('/api/path/' + this.toolpath.filename + '/positions');
-      var d2 = get('/api/path/' + this.toolpath.filename + '/speeds');
+      api.get('path/' + this.toolpath.filename + '/chunks')
+        .done(function (index) {
+          if (loadID != this.loadID) return;
 
-      $.when(d1, d2).done(function (positions, speeds) {
-        this.positions = positions
-        this.speeds = speeds;
-        this.loading = false;
+          // Coarse levels are first in the file, fetch every chunk's coarsest
+          var end = 0;
+          for (var i = 0; i < index.chunks.length; i++) {
+            var levels = index.chunks[i].levels;
+            var level = levels[levels.length - 1];
+            end = Math.max(end, level.offset + level.length);
+          }
 
-        // Update scene
-        this.scene = new THREE.Scene();
-        this.draw(this.scene);
-        this.snap(this.snapView);
+          get_range(0, end).done(function (data) {
+            if (loadID != this.loadID) return;
+
+            this.pathIndex = index;
+            this.pathChunks = [];
+            for (var i = 0; i < index.chunks.length; i++) {
+              var levels = index.chunks[i].levels;
+              var level = levels[levels.length - 1];
+              this.pathChunks.push(this.decode_chunk(data, 0, level));
+            }
+
+            this.loading = false;
+
+            // Update scene
+            this.scene = new THREE.Scene();
+            this.draw(this.scene);
+            this.snap(this.snapView);
+
+            this.update_view();
+            this.refine_path(index, 0, get_range, loadID);
+          }.bind(this))
+        }.bind(this))
+    },
+
+
+    decode_chunk: function (data, start, level) {
+      return toolpath.decode(data, level.offset - start, level,
+                             this.pathIndex.origin, this.pathIndex.quantum);
+    },
+
+
+    refine_path: function (index, first, get_range, loadID) {
+      // Fetch full detail chunks a few at a time
+      var chunks = index.chunks;
+      var maxBytes = 4 * 1024 * 1024;
 
-        this.update_view();
+      // Skip chunks that were already loaded at full detail
+      while (first < chunks.length && chunks[first].levels.length == 1) first++;
+      if (first == chunks.length) return;
+
+      // Extend the request over chunks that follow in the file
+      var start = chunks[first].levels[0].offset;
+      var end = start + chunks[first].levels[0].length;
+      var last = first + 1;
+
+      while (last < chunks.length && end - start < maxBytes) {
+        var level = chunks[last].levels[0];
+        if (level.offset != end) break;
+        end += level.length;
+        last++;
+      }
+
+      get_range(start, end).done(function (data) {
+        if (loadID != this.loadID) return;
+
+        for (var i = first; i < last; i++) {
+          this.pathChunks[i] = this.decode_chunk(data, start,
+                                                 chunks[i].levels[0]);
+          this.redraw_chunk(i);
+        }
+
+        this.refine_path(index, last, get_range, loadID);
       }.bind(this))
     },
 
@@ -499,20 +564,15 @@ module.exports = {
     },
 
 
-    draw_path: function (scene) {
+    draw_chunk: function (chunk) {
       var geometry = new THREE.BufferGeometry();
-      var material =
-          new THREE.LineBasicMaterial({
-            vertexColors: THREE.VertexColors,
-            linewidth: 1.5
-          });
 
-      var positions = new THREE.Float32BufferAttribute(this.positions, 3);
+      var positions = new THREE.Float32BufferAttribute(chunk.positions, 3);
       geometry.addAttribute('position', positions);
 
       var colors = [];
-      for (var i = 0; i < this.speeds.length; i++) {
-        var color = this.get_color(this.speeds[i]);
+      for (var i = 0; i < chunk.speeds.length; i++) {
+        var color = this.get_color(chunk.speeds[i]);
         Array.prototype.push.apply(colors, color);
       }
 
@@ -522,12 +582,42 @@ module.exports = {
       geometry.computeBoundingSphere();
       geometry.computeBoundingBox();
 
-      var line = new THREE.Line(geometry, material);
+      return new THREE.Line(geometry, this.pathMaterial);
+    },
 
-      line.visible = this.showPath;
-      scene.add(line);
 
-      return line;
+    redraw_chunk: function (i) {
+      if (typeof this.pathView == 'undefined') return;
+
+      var old = this.pathLines[i];
+      this.pathLines[i] = this.draw_chunk(this.pathChunks[i]);
+      this.pathView.remove(old);
+      this.pathView.add(this.pathLines[i]);
+      old.geometry.dispose();
+
+      this.dirty = true;
+    },
+
+
+    draw_path: function (scene) {
+      this.pathMaterial =
+          new THREE.LineBasicMaterial({
+            vertexColors: THREE.VertexColors,
+            linewidth: 1.5
+          });
+
+      var group = new THREE.Group();
+      this.pathLines = [];
+
+      for (var i = 0; i < this.pathChunks.length; i++) {
+        this.pathLines.push(this.draw_chunk(this.pathChunks[i]));
+        group.add(this.pathLines[i]);
+      }
+
+      group.visible = this.showPath;
+      scene.add(group);
+
+      return group;
     },
 
 
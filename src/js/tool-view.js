@@ -85,6 +85,11 @@ module.exports = {
 
     get_reg_addr: function (reg) {return this.state[reg + 'va']},
     get_reg_value: function (reg) {return this.state[reg + 'vv']},
+    get_reg_bus_id: function (reg) {return this.state[reg + 'vi']},
+    get_reg_poll_period: function (reg) {return this.state[reg + 'vp']},
+
+
+    get_reg_read: function (reg) {return this.state[reg + 'vd']},
 
 
     get_reg_fails: function (reg) {
@@ -121,6 +126,8 @@ module.exports = {
         regs[i]['reg-type']  = this.get_reg_type(reg);
         regs[i]['reg-addr']  = this.get_reg_addr(reg);
         regs[i]['reg-value'] = this.get_reg_value(reg);
+        regs[i]['reg-bus-id'] = this.get_reg_bus_id(reg);
+        regs[i]['reg-poll-period'] = this.get_reg_poll_period(reg);
       }
 
       this.$dispatch('config-changed');
@@ -136,6 +143,8 @@ module.exports = {
         regs[i]['reg-type']  = 'disabled';
         regs[i]['reg-addr']  = 0;
         regs[i]['reg-value'] = 0;
+        regs[i]['reg-bus-id'] = 0;
+        regs[i]['reg-poll-period'] = 0;
       }
 
       this.$dispatch('config-changed');
@@ -0,0 +1,82 @@
+/******************************************************************************\
+
+                 This file is part of the Buildbotics firmware.
+
+                   Copyright (c) 2015 - 2018, Buildbotics LLC
+                              All rights reserved.
+
+      This file ("the software") is free software: you can redistribute it
+      and/or modify it under the terms of the GNU General Public License,
+       version 2 as published by the Free Software Foundation. You should
+       have received a copy of the GNU General Public License, version 2
+      along with the software. If not, see <http://www.gnu.org/licenses/>.
+
+      The software is distributed in the hope that it will be useful, but
+           WITHOUT ANY WARRANTY; without even the implied warranty of
+       MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+                Lesser General Public License for more details.
+
+        You should have received a copy of the GNU Lesser General Public
+                 License along with the software.  If not, see
+                        <http://www.gnu.org/licenses/>.
+
+                 For information regarding this software email:
+                   "Joseph Coffland" <joseph@buildbotics.com>
+
+\******************************************************************************/
+
+'use strict'
+
+
+// Decodes a level of a chunked toolpath, see src/py/bbctrl/chunk.py
+module.exports = {
+  decode: function (data, offset, level, origin, quantum) {
+    var bytes = new Uint8Array(data, offset, level.length);
+    var view = new DataView(data, offset, level.length);
+    var pos = 0;
+
+    function varint() {
+      var value = 0;
+      var scale = 1;
+
+      while (true) {
+        var b = bytes[pos++];
+        value += (b & 0x7f) * scale; // Multiply, shifts overflow 32 bits
+        if (b < 0x80) return value;
+        scale *= 128;
+      }
+    }
+
+    // Positions
+    var positions = new Float32Array(level.count * 3);
+    var last = [0, 0, 0];
+
+    for (var i = 0; i < positions.length; i++) {
+      var axis = i % 3;
+      var z = varint();
+      last[axis] += z % 2 ? -(z + 1) / 2 : z / 2;
+      positions[i] = origin[axis] + last[axis] * quantum;
+    }
+
+    // Speed palette
+    var palette = [];
+    var n = varint();
+    for (i = 0; i < n; i++) {
+      palette.push(view.getFloat32(pos, true));
+      pos += 4;
+    }
+
+    // Speed runs
+    var speeds = new Float32Array(level.count);
+    var runs = varint();
+    var j = 0;
+
+    for (i = 0; i < runs; i++) {
+      var length = varint();
+      var speed = palette[varint()];
+      while (length--) speeds[j++] = speed;
+    }
+
+    return {positions: positions, speeds: speeds};
+  }
+}
@@ -116,6 +116,11 @@ class AVR(object):
         self.ctrl.ioloop.update_handler(self.sp, flags)
 
 
+    def write_space(self):
+        # Free space in bbserial's transmit ring buffer
+        return (1 << 16) - 1 - self.sp.out_waiting
+
+
     def _serial_write(self):
         self.write_cb(lambda data: self.sp.write(data))
 
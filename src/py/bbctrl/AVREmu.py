@@ -148,6 +148,9 @@ class AVREmu(object):
         self.write_enabled = enable
 
 
+    def write_space(self): return 1 << 16 # Default pipe capacity
+
+
     def _avr_write(self, data):
         try:
             length = os.write(self.avrOut, data)
@@ -37,6 +37,7 @@ SET_SYNC     = '#'
 MODBUS_READ  = 'm'
 MODBUS_WRITE = 'M'
 SEEK         = 's'
+PROBE        = 'b'
 SET_AXIS     = 'a'
 LINE         = 'l'
 SYNC_SPEED   = '%'
@@ -127,18 +128,21 @@ def sync_speed(dist, speed):
     return SYNC_SPEED + encode_float(dist) + encode_float(speed)
 
 
+def input_port(port):
+    # Analog/digital & port index, see io.c for the port mapping
+    if port.startswith('digital-in-'): type, index, count = 'd', port[11:], 9
+    elif port.startswith('analog-in-'): type, index, count = 'a', port[10:], 2
+    else: type, index, count = None, '', 0
+
+    if not index.isdigit() or count <= int(index):
+        raise Exception('Invalid input port "%s"' % port)
+
+    return type, int(index)
+
+
 def input(port, mode, timeout):
-    type, index, m = 'd', 0, 0
-
-    # Analog/digital & port index
-    if port == 'digital-in-0': type, index = 'd', 0
-    if port == 'digital-in-1': type, index = 'd', 1
-    if port == 'digital-in-2': type, index = 'd', 2
-    if port == 'digital-in-3': type, index = 'd', 3
-    if port == 'analog-in-0':  type, index = 'a', 0
-    if port == 'analog-in-1':  type, index = 'a', 1
-    if port == 'analog-in-2':  type, index = 'a', 2
-    if port == 'analog-in-3':  type, index = 'a', 3
+    type, index = input_port(port)
+    m = 0
 
     # Mode
     if mode == 'immediate': m = 0
@@ -168,7 +172,13 @@ def pause(type):
     return '%s%d' % (PAUSE, type)
 
 
-def jog(axes): return JOG + encode_axes(axes)
+def jog(axes, mode = None, velocity = 1):
+    cmd = JOG
+
+    if mode == 'incremental': cmd += 'i' + encode_float(velocity)
+    elif mode == 'target': cmd += 't' + encode_float(velocity)
+
+    return cmd + encode_axes(axes)
 
 
 def seek(switch, active, error):
@@ -182,6 +192,17 @@ def seek(switch, active, error):
     return cmd
 
 
+def probe(switch, active, error, velocity, target):
+    cmd = PROBE + str(switch)
+
+    flags = 0
+    if active: flags |= SEEK_ACTIVE
+    if error:  flags |= SEEK_ERROR
+    cmd += chr(flags + ord('0'))
+
+    return cmd + encode_float(velocity) + encode_axes(target)
+
+
 def decode_command(cmd):
     if not len(cmd): return
 
@@ -67,13 +67,20 @@ def driver_flags_to_string(flags):
 
 
 class Comm(object):
+    # Whole commands are gathered in to writes of up to this many bytes
+    max_write = 4096
+
+
     def __init__(self, ctrl, avr):
         self.ctrl = ctrl
         self.avr = avr
         self.log = self.ctrl.log.get('Comm')
+        self.log_traffic = ctrl.args.log_comm
         self.queue = deque()
         self.in_buf = ''
-        self.command = None
+        self.out_buf = bytearray()
+        self.out_next = None
+        self.out_partial = False
         self.last_motor_flags = [0] * 4
 
         avr.set_handlers(self._read, self._write)
@@ -82,9 +89,12 @@ class Comm(object):
 
     def comm_next(self): raise Exception('Not implemented')
     def comm_error(self): raise Exception('Not implemented')
+    def comm_result(self, result): raise Exception('Not implemented')
 
 
-    def is_active(self): return len(self.queue) or self.command is not None
+    def is_active(self):
+        return (len(self.queue) or len(self.out_buf) or
+                self.out_next is not None)
 
 
     def i2c_command(self, cmd, byte = None, word = None, block = None):
@@ -95,9 +105,15 @@ class Comm(object):
     def flush(self): self.avr.enable_write(True)
 
 
-    def _load_next_command(self, cmd):
-        self.log.info('< ' + json.dumps(cmd).strip('"'))
-        self.command = bytes(cmd.strip() + '\n', 'utf-8')
+    def _next_command(self):
+        if len(self.queue): cmd = self.queue.popleft()
+        else:
+            cmd = self.comm_next() # pylint: disable=assignment-from-no-return
+            if cmd is None: return
+
+        if self.log_traffic: self.log.info('< %s', json.dumps(cmd).strip('"'))
+
+        return (cmd.strip() + '\n').encode('utf-8')
 
 
     def resume(self): self.queue_command(Cmd.RESUME)
@@ -114,29 +130,52 @@ class Comm(object):
         self.ctrl.ioloop.call_later(1, self._poll_cb)
 
 
+    def _clear_output(self, rebooted = False):
+        # Drop commands not yet written, except the rest of one partly written
+        # unless the AVR has since lost its first part
+        if rebooted: self.out_partial = False
+        end = self.out_buf.find(b'\n') + 1 if self.out_partial else 0
+        del self.out_buf[end:]
+        self.out_next = None
+
+
     def _write(self, write_cb):
-        # Finish writing current command
-        if self.command is not None:
-            try:
-                count = write_cb(self.command)
+        # Gather whole queued then planner commands in to one write which
+        # fits in the serial driver's free space
+        space = self.avr.write_space()
 
-            except Exception as e:
-                self.command = None
-                raise e
+        while True:
+            if self.out_next is None: self.out_next = self._next_command()
+            cmd = self.out_next
+            if cmd is None: break
 
-            self.command = self.command[count:]
-            if len(self.command): return # There's more
-            self.command = None
+            size = len(self.out_buf) + len(cmd)
+            if space < size or (len(self.out_buf) and self.max_write < size):
+                break
 
-        # Load next command from queue
-        if len(self.queue): self._load_next_command(self.queue.popleft())
+            self.out_buf += cmd
+            self.out_next = None
 
-        # Load next command from callback
-        else:
-            cmd = self.comm_next() # pylint: disable=assignment-from-no-return
+        if not len(self.out_buf):
+            self.avr.enable_write(False) # Stop writing
 
-            if cmd is None: self.avr.enable_write(False) # Stop writing
-            else: self._load_next_command(cmd)
+            # Wait for the driver to drain
+            if self.out_next is not None:
+                self.ctrl.ioloop.call_later(0.01, self.flush)
+
+            return
+
+        try:
+            count = write_cb(self.out_buf)
+
+        except Exception as e:
+            self.out_buf = bytearray()
+            self.out_partial = False
+            raise e
+
+        if count:
+            self.out_partial = self.out_buf[count - 1] != ord('\n')
+            del self.out_buf[:count]
 
 
     def _update_vars(self, msg):
@@ -207,7 +246,7 @@ class Comm(object):
             self.in_buf = self.in_buf[i + 1:]
 
             if line:
-                self.log.info('> ' + line)
+                if self.log_traffic: self.log.info('> %s', line)
 
                 try:
                     msg = json.loads(line)
@@ -219,6 +258,14 @@ class Comm(object):
                 if 'variables' in msg: self._update_vars(msg)
                 elif 'msg' in msg: self._log_msg(msg)
 
+                elif 'result' in msg:
+                    self.comm_result(msg['result'])
+                    self.flush() # Planner may have more data now
+
+                elif 'analog_stream' in msg:
+                    # Filtered 12-bit samples, interleaved by analog port
+                    self.ctrl.state.set('analog_stream', msg['analog_stream'])
+
                 elif 'firmware' in msg:
                     self.log.info('AVR firmware rebooted')
                     self.connect()
@@ -228,9 +275,15 @@ class Comm(object):
 
     def estop(self):
         if self.ctrl.state.get('xx', '') != 'ESTOPPED':
+            self._clear_output()
             self.i2c_command(Cmd.ESTOP)
 
 
+    def stop(self):
+        self._clear_output()
+        self.i2c_command(Cmd.STOP)
+
+
     def clear(self):
         if self.ctrl.state.get('xx', '') == 'ESTOPPED':
             self.i2c_command(Cmd.CLEAR)
@@ -240,10 +293,14 @@ class Comm(object):
         self.i2c_command(Cmd.PAUSE, byte = ord('0')) # User pause
 
 
-    def reboot(self): self.queue_command(Cmd.REBOOT)
+    def reboot(self):
+        self._clear_output()
+        self.queue_command(Cmd.REBOOT)
 
 
     def connect(self):
+        self._clear_output(True)
+
         try:
             # Resume once current queue of GCode commands has flushed
             self.queue_command(Cmd.RESUME)
@@ -38,47 +38,53 @@ class CommandQueue():
         self.log = ctrl.log.get('CmdQ')
         self.log.set_level(bbctrl.log.WARNING)
 
-        self.lastEnqueueID = 0
+        self.lastEnqueueID = None
         self.releaseID = 0
-        self.q = deque()
+        self.q = deque() # (id, cb, args) in ID order, only real callbacks
 
 
-    def is_active(self): return len(self.q)
+    def is_active(self):
+        return self.lastEnqueueID is not None and \
+            id_less(self.releaseID, self.lastEnqueueID)
 
 
     def clear(self):
-        self.lastEnqueueID = 0
+        self.lastEnqueueID = None
         self.releaseID = 0
         self.q.clear()
 
 
-    def enqueue(self, id, cb, *args, **kwargs):
-        self.log.info('add(#%d) releaseID=%d', id, self.releaseID)
+    def enqueue(self, id, cb, *args):
         self.lastEnqueueID = id
-        self.q.append([id, cb, args, kwargs])
-        self._release()
+        if cb is None: return # Only track the ID
 
+        # Run now if already released
+        if not len(self.q) and not id_less(self.releaseID, id):
+            self._call(id, cb, args)
+
+        else: self.q.append((id, cb, args))
 
-    def _release(self):
-        while len(self.q):
-            id, cb, args, kwargs = self.q[0]
 
-            # Execute commands <= releaseID
-            if id_less(self.releaseID, id): return
+    def _call(self, id, cb, args):
+        self.log.info('releasing id=%d', id)
 
-            self.log.info('releasing id=%d' % id)
-            self.q.popleft()
+        try:
+            cb(*args)
+        except Exception:
+            self.log.exception('During command queue callback')
 
-            try:
-                if cb is not None: cb(*args, **kwargs)
-            except Exception:
-                self.log.exception('During command queue callback')
 
+    def _release(self):
+        q = self.q
+
+        # Execute callbacks <= releaseID
+        while len(q) and not id_less(self.releaseID, q[0][0]):
+            self._call(*q.popleft())
 
 
     def release(self, id):
         if id and not id_less(self.releaseID, id):
-            self.log.debug('id out of order %d <= %d' % (id, self.releaseID))
+            self.log.debug('id out of order %d <= %d', id, self.releaseID)
         self.releaseID = id
 
         self._release()
@@ -50,6 +50,22 @@ axis_homing_procedure = '''
   G90 G28.3 %(axis)s[#<_%(axis)s_home_position>]
 '''
 
+# Stall homing has no latch, the stall point is only repeatable to a full step
+stall_homing_procedure = '''
+  G28.2 %(axis)s0 F[#<_%(axis)s_search_velocity>]
+  G38.6 %(axis)s[#<_%(axis)s_home_travel>]
+  G91 G0 G53 %(axis)s[#<_%(axis)s_zero_backoff>]
+  G90 G28.3 %(axis)s[#<_%(axis)s_home_position>]
+'''
+
+# Stall calibration runs the motor freely at the search velocity, away from
+# the homing side and back
+stall_calibrate_procedure = '''
+  G91 G1 G53 %(axis)s%(travel)f F[#<_%(axis)s_search_velocity>]
+  G1 G53 %(axis)s%(back)f
+  G90
+'''
+
 motor_fault_error = '''\
 Motor %d driver fault.  A potentially damaging electrical condition was \
 detected and the motor driver was shutdown.  Please power down the controller \
@@ -77,6 +93,7 @@ class Mach(Comm):
 
         self.planner = bbctrl.Planner(ctrl)
         self.unpausing = False
+        self.stall_calibrating = None
 
         ctrl.state.set('cycle', 'idle')
 
@@ -129,6 +146,17 @@ class Mach(Comm):
         # Handle EStop
         if state_changed and state == 'ESTOPPED': self.planner.reset(False)
 
+        # Following error hold
+        if update.get('pr', '') == 'Following error':
+            self.mlog.error('Motor following error exceeded.  Check for '
+                            'missed steps.')
+
+        # Stall calibration done
+        motor = self.stall_calibrating
+        if motor is not None and not update.get('%dsk' % motor, True):
+            self.stall_calibrating = None
+            self._stall_calibrated(motor)
+
         # Exit cycle if state changed to READY
         if (state_changed and self._get_cycle() != 'idle' and
             self._is_ready() and not self.planner.is_busy() and
@@ -136,6 +164,13 @@ class Mach(Comm):
             self.planner.position_change()
             self._set_cycle('idle')
 
+            if self.stall_calibrating is not None:
+                self.mlog.error('Motor %d stall calibration did not complete' %
+                                self.stall_calibrating)
+                super().queue_command(
+                    Cmd.set_sync('%dsk' % self.stall_calibrating, 0))
+                self.stall_calibrating = None
+
         # Unpause sync
         if state_changed and state != 'HOLDING': self.unpausing = False
 
@@ -189,6 +224,10 @@ class Mach(Comm):
     def comm_error(self): self._reset()
 
 
+    @overrides(Comm)
+    def comm_result(self, result): self.planner.input_result(result)
+
+
     @overrides(Comm)
     def connect(self):
         self._reset()
@@ -230,7 +269,8 @@ class Mach(Comm):
     def jog(self, axes):
         self._begin_cycle('jogging')
         self.planner.position_change()
-        super().queue_command(Cmd.jog(axes))
+        super().queue_command(Cmd.jog(axes, axes.get('mode'),
+                                      axes.get('velocity', 1)))
 
 
     def home(self, axis, position = None):
@@ -261,13 +301,57 @@ class Mach(Comm):
                 self.mdi('G28.3 %c%f' % (axis, position))
                 continue
 
+            if mode[:6] == 'stall-': procedure = stall_homing_procedure
+            else: procedure = axis_homing_procedure
+
             # Home axis
             self.mlog.info('Homing %s axis' % axis)
             self._begin_cycle('homing')
-            self.planner.mdi(axis_homing_procedure % {'axis': axis}, False)
+            self.planner.mdi(procedure % {'axis': axis}, False)
             super().resume()
 
 
+    def calibrate_stall(self, axis):
+        state = self.ctrl.state
+        axis = '%c' % axis
+
+        motor = state.find_motor(axis)
+        if motor is None or not state.motor_enabled(motor):
+            raise Exception('Cannot calibrate %s axis stall: Motor disabled' %
+                            axis.upper())
+
+        if state.motor_homing_mode(motor)[:6] != 'stall-':
+            raise Exception('Cannot calibrate %s axis stall: Not configured '
+                            'for stall homing' % axis.upper())
+
+        # Quarter of the travel away from the homing side
+        travel = state.get('%dtm' % motor, 0) - state.get('%dtn' % motor, 0)
+        travel *= -0.25 * state.motor_home_direction(motor)
+
+        self.mlog.info('Calibrating %s axis stall threshold' % axis.upper())
+        self._begin_cycle('homing')
+        self.stall_calibrating = motor
+        super().queue_command(Cmd.set_sync('%dsk' % motor, 1))
+        self.planner.mdi(stall_calibrate_procedure % {
+            'axis': axis, 'travel': travel, 'back': -travel}, False)
+        super().resume()
+
+
+    def _stall_calibrated(self, motor):
+        threshold = self.ctrl.state.get('%dth' % motor, 0)
+
+        if not threshold:
+            self.mlog.error('Motor %d stall calibration failed, stall '
+                            'detected at search velocity' % motor)
+            return
+
+        self.mlog.info('Motor %d stall threshold %d' % (motor, threshold))
+
+        config = self.ctrl.config.load()
+        config['motors'][motor]['stall-threshold'] = threshold
+        self.ctrl.config.save(config)
+
+
     def unhome(self, axis): self.mdi('G28.2 %c0' % axis)
     def estop(self): super().estop()
 
@@ -278,11 +362,17 @@ class Mach(Comm):
             super().clear()
 
 
-    def start(self):
+    def start(self, line = None):
         filename = self.ctrl.state.get('selected', '')
         if not filename: return
         self._begin_cycle('running')
-        self.planner.load(filename)
+
+        try:
+            self.planner.load(filename, line)
+        except:
+            self._set_cycle('idle')
+            raise
+
         super().resume()
 
 
@@ -292,7 +382,7 @@ class Mach(Comm):
         else: super().i2c_command(Cmd.UNPAUSE)
 
 
-    def stop(self): super().i2c_command(Cmd.STOP)
+    def stop(self): super().stop()
     def pause(self): super().pause()
 
 
@@ -32,6 +32,7 @@ import time
 from collections import deque
 import camotics.gplan as gplan # pylint: disable=no-name-in-module,import-error
 import bbctrl.Cmd as Cmd
+import bbctrl.checkpoint as checkpoint
 from bbctrl.CommandQueue import CommandQueue
 
 
@@ -54,12 +55,24 @@ def log_json(o): return json.dumps(log_floats(o))
 
 
 class Planner():
+    # Bounds in seconds on how far ahead of the AVR moves are committed
+    min_ahead = 1
+    max_ahead = 5
+
+
     def __init__(self, ctrl):
         self.ctrl = ctrl
         self.log = ctrl.log.get('Planner')
         self.cmdq = CommandQueue(ctrl)
         self.planner = None
         self._position_dirty = False
+        self._feed = 0
+        self._probe = None
+        self._line_offset = 0
+        self._ahead = self.min_ahead
+        self._underrun = None
+        self._last_underrun = time.time()
+        self._throttled = False
         self.where = ''
 
         ctrl.state.add_listener(self._update)
@@ -131,6 +144,50 @@ class Planner():
             self.planner.set_active(id) # Release planner commands
             self.cmdq.release(id)       # Synchronize planner variables
 
+            # Nothing left in flight
+            if not self.cmdq.is_active(): self._buffered = 0
+
+        # Resume sending once the buffer drains below target
+        if ('id' in update or 'qt' in update) and self._throttled and \
+                self._buffer_time() < self._ahead:
+            self._throttled = False
+            self.ctrl.mach.flush()
+
+        if 'un' in update: self._check_underrun(update['un'])
+
+
+    def _check_underrun(self, count):
+        last, self._underrun = self._underrun, count
+        if last is None or count <= last: return
+        if self.ctrl.state.get('xx', '') != 'RUNNING': return
+
+        self._last_underrun = time.time()
+        ahead = min(self.max_ahead, self._ahead * 1.5)
+
+        if ahead != self._ahead:
+            self.log.info('Stepper underrun, buffering %.2fs ahead', ahead)
+            self._ahead = ahead
+
+
+    def _buffer_time(self):
+        # Moves still in transit are only counted here, the AVR's queue time
+        # covers moves it holds when id reports lag.  It is stale once
+        # nothing is in flight, e.g. after a stop flushes the queue.
+        if not self.cmdq.is_active(): return self._buffered
+        return max(self._buffered, self.ctrl.state.get('qt', 0) / 1000)
+
+
+    def _decay_ahead(self):
+        # Slowly reduce buffering while moves keep up
+        if time.time() - self._last_underrun < 10: return
+        self._last_underrun = time.time()
+        self._ahead = max(self.min_ahead, self._ahead * 0.9)
+
+
+    def input_result(self, result):
+        self.log.info('Input result: %s' % result)
+        if self.planner.is_synchronizing(): self.planner.synchronize(result)
+
 
     def _get_var_cb(self, name, units):
         value = 0
@@ -194,6 +251,9 @@ class Planner():
 
         elif state != 'HOLDING': self.ctrl.state.set('plan_time', 0)
 
+        if state == 'RUNNING': self._decay_ahead()
+        self.ctrl.state.set('buffer_time', round(self._buffered * 1000))
+
         self.ctrl.ioloop.call_later(1, self._report_time)
 
 
@@ -202,13 +262,15 @@ class Planner():
 
 
     def _update_time(self, plan_time, move_time):
+        self._buffered = max(0, self._buffered - move_time)
         self.current_plan_time = plan_time
         self.move_time = move_time
         self.move_start = time.time()
 
 
-    def _enqueue_line_time(self, block):
-        if block.get('first', False) or block.get('seeking', False): return
+    def _enqueue_line_time(self, block, probe = False):
+        if block.get('first', False): return
+        if block.get('seeking', False) and not probe: return
 
         # Sum move times
         move_time = sum(block['times']) / 1000 # To seconds
@@ -217,12 +279,19 @@ class Planner():
                           move_time)
 
         self.plan_time += move_time
+        self._buffered += move_time
 
 
     def _enqueue_dwell_time(self, block):
         self.cmdq.enqueue(block['id'], self._update_time, self.plan_time,
                           block['seconds'])
         self.plan_time += block['seconds']
+        self._buffered += block['seconds']
+
+
+    def _encode_seek(self, block):
+        sw = self.ctrl.state.get_switch_id(block['switch'])
+        return Cmd.seek(sw, block['active'], block['error'])
 
 
     def __encode(self, block):
@@ -230,6 +299,23 @@ class Planner():
 
         if type != 'set': self.log.info('Cmd:' + log_json(block))
 
+        # Probe seeks are combined with the following move and run as a
+        # probe cycle on the AVR
+        if self._probe is not None:
+            probe, self._probe = self._probe, None
+
+            if type == 'line':
+                # Count the whole move, the probe cycle ends in a hold
+                self._enqueue_line_time(block, True)
+
+                sw = self.ctrl.state.get_switch_id(probe['switch'])
+                return Cmd.probe(sw, probe['active'], probe['error'],
+                                 self._feed, block['target'])
+
+            cmd = self.__encode(block)
+            seek = self._encode_seek(probe)
+            return seek if cmd is None else seek + '\n' + cmd
+
         if type == 'line':
             self._enqueue_line_time(block)
             return Cmd.line(block['target'], block['exit-vel'],
@@ -242,6 +328,7 @@ class Planner():
             if name == 'message':
                 self.cmdq.enqueue(id, self._add_message, value)
 
+            if name == 'line': value += self._line_offset
             if name in ['line', 'tool']: self._enqueue_set_cmd(id, name, value)
 
             if name == 'speed':
@@ -254,6 +341,7 @@ class Planner():
                     self._enqueue_set_cmd(id, name[1:], value)
 
             if name == '_feed': # Must come after _enqueue_set_cmd() above
+                self._feed = value
                 return Cmd.set_sync('if', 1 / value if value else 0)
 
             if name[0:1] == '_' and name[1:2] in 'xyzabc':
@@ -267,8 +355,7 @@ class Planner():
             return
 
         if type == 'input':
-            # TODO handle timeout
-            self.planner.synchronize(0) # TODO Fix this
+            # The planner waits here until the AVR reports the result
             return Cmd.input(block['port'], block['mode'], block['timeout'])
 
         if type == 'output':
@@ -281,8 +368,11 @@ class Planner():
         if type == 'pause': return Cmd.pause(block['pause-type'])
 
         if type == 'seek':
-            sw = self.ctrl.state.get_switch_id(block['switch'])
-            return Cmd.seek(sw, block['active'], block['error'])
+            if block['switch'].lower() == 'probe' and self._feed:
+                self._probe = block
+                return
+
+            return self._encode_seek(block)
 
         if type == 'end': return '' # Sends id
 
@@ -302,6 +392,8 @@ class Planner():
         self.move_time = 0
         self.plan_time = 0
         self.current_plan_time = 0
+        self._buffered = 0
+        self._throttled = False
 
 
     def close(self):
@@ -318,6 +410,8 @@ class Planner():
         # TODO logger is global and will not work correctly in demo mode
         self.planner.set_logger(self._log_cb, 1, 'LinePlanner:3')
         self._position_dirty = True
+        self._probe = None
+        self._line_offset = 0
         self.cmdq.clear()
         self.reset_times()
         self.ctrl.state.reset()
@@ -327,16 +421,39 @@ class Planner():
         self.where = '<mdi>'
         self.log.info('MDI:' + cmd)
         self._sync_position()
+        self._line_offset = 0
         self.planner.load_string(cmd, self.get_config(True, with_limits))
         self.reset_times()
 
 
-    def load(self, path):
+    def _restart_at(self, path, line, config):
+        # Skip to the preplanner's nearest checkpoint instead of interpreting
+        # the whole program before line
+        checkpoints = self.ctrl.preplanner.get_checkpoints(self.where)
+        restart = self.ctrl.get_plan(self.where + '.restart.gcode')
+
+        with open(restart, 'wb') as f:
+            self._line_offset, modal = \
+                checkpoint.restart(path, config, checkpoints, line, f)
+
+        if 'T' in modal.words:
+            self.ctrl.state.set('tool', int(modal.words['T']))
+
+        self.log.info('Starting at line %d' % line)
+
+        return restart
+
+
+    def load(self, path, line = None):
         self.where = path
         path = self.ctrl.get_path('upload', path)
         self.log.info('GCode:' + path)
         self._sync_position()
-        self.planner.load(path, self.get_config(False, True))
+        config = self.get_config(False, True)
+        self._line_offset = 0
+        if line is not None and 1 < line:
+            path = self._restart_at(path, line, config)
+        self.planner.load(path, config)
         self.reset_times()
 
 
@@ -344,6 +461,8 @@ class Planner():
         try:
             self.planner.stop()
             self.cmdq.clear()
+            self._probe = None
+            self._buffered = 0
 
         except:
             self.log.exception()
@@ -355,10 +474,14 @@ class Planner():
             id = self.ctrl.state.get('id')
             position = self.ctrl.state.get_position()
 
+            # After a probe cycle this is where the AVR left the machine,
+            # G38 results follow it and the trigger position is <axis>tp
             self.log.info('Planner restart: %d %s' % (id, log_json(position)))
 
             self.cmdq.clear()
             self.cmdq.release(id)
+            self._probe = None
+            self._buffered = 0
             self._plan_time_restart()
             self.planner.restart(id, position)
 
@@ -368,6 +491,12 @@ class Planner():
 
 
     def next(self):
+        # Limit how far ahead of execution moves are committed so pause,
+        # stop and overrides take effect promptly
+        if self._ahead <= self._buffer_time():
+            self._throttled = True
+            return
+
         try:
             while self.planner.has_more():
                 cmd = self.planner.next()
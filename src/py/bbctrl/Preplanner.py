@@ -35,6 +35,7 @@ import signal
 from concurrent.futures import Future
 from tornado import gen, process, iostream
 import bbctrl
+import bbctrl.checkpoint as checkpoint
 
 
 def hash_dump(o):
@@ -43,9 +44,10 @@ def hash_dump(o):
 
 
 def plan_hash(path, config):
+    # Only the settings the planner consumes, see checkpoint.config_key()
     h = hashlib.sha256()
-    h.update('v4'.encode('utf8'))
-    h.update(hash_dump(config))
+    h.update('v6'.encode('utf8'))
+    h.update(hash_dump(checkpoint.config_key(config)))
 
     with open(path, 'rb') as f:
         while True:
@@ -56,6 +58,19 @@ def plan_hash(path, config):
     return h.hexdigest()
 
 
+def available_memory():
+    try:
+        with open('/proc/meminfo', 'r') as f:
+            for line in f:
+                if line.startswith('MemAvailable:'):
+                    return int(line.split()[1]) * 1024
+    except: pass
+
+
+# Plan files kept after planning
+plan_files = ('meta.json', 'chunks.json', 'path.bin', 'checkpoints.json')
+
+
 def safe_remove(path):
     try:
         os.unlink(path)
@@ -65,6 +80,7 @@ def safe_remove(path):
 class Plan(object):
     def __init__(self, preplanner, ctrl, filename):
         self.preplanner = preplanner
+        self.filename = filename
 
         # Copy planner state
         self.state = ctrl.state.snapshot()
@@ -80,10 +96,8 @@ class Plan(object):
         self.base = '%s/plans/%s' % (root, filename)
         self.hid = plan_hash(self.gcode, self.config)
         fbase = '%s.%s.' % (self.base, self.hid)
-        self.files = [
-            fbase + 'json',
-            fbase + 'positions.gz',
-            fbase + 'speeds.gz']
+        self.files = [fbase + name for name in plan_files]
+        self.files[0] = fbase + 'json'
 
         self.future = Future()
         ctrl.ioloop.add_callback(self._load)
@@ -105,6 +119,8 @@ class Plan(object):
 
     def clean(self, max = 2):
         plans = glob.glob(self.base + '.*.json')
+        plans = [path for path in plans
+                 if '.' not in path[len(self.base) + 1:-5]]
         if len(plans) <= max: return
 
         # Delete oldest plans
@@ -113,8 +129,7 @@ class Plan(object):
 
         for mtime, path in plans[:len(plans) - max]:
             safe_remove(path)
-            safe_remove(path[:-4] + 'positions.gz')
-            safe_remove(path[:-4] + 'speeds.gz')
+            for name in plan_files[1:]: safe_remove(path[:-4] + name)
 
 
     def _exists(self):
@@ -127,11 +142,11 @@ class Plan(object):
         if self.cancel: return
 
         try:
-            with open(self.files[0], 'r')  as f: meta = json.load(f)
-            with open(self.files[1], 'rb') as f: positions = f.read()
-            with open(self.files[2], 'rb') as f: speeds = f.read()
+            with open(self.files[0], 'r') as f: meta = json.load(f)
+            with open(self.files[1], 'r') as f: chunks = json.load(f)
 
-            return meta, positions, speeds
+            # Path data is served from disk, see PathHandler
+            return dict(meta = meta, chunks = chunks, path = self.files[2])
 
         except:
             self.preplanner.log.exception()
@@ -142,19 +157,67 @@ class Plan(object):
                     os.remove(path)
 
 
+    @gen.coroutine
+    def _run_script(self, tmpdir, name, *args):
+        cmd = ('/usr/bin/env', 'python3', bbctrl.get_resource(name)) + args
+        proc = process.Subprocess(cmd, stderr = process.Subprocess.STREAM,
+                                  cwd = tmpdir)
+        self.pid = proc.proc.pid
+
+        try:
+            ret = yield proc.wait_for_exit(False)
+            if ret:
+                errs = yield proc.stderr.read_until_close()
+                raise Exception('%s failed: %s' % (name, errs.decode('utf8')))
+
+        finally: proc.stderr.close()
+
+
+    @gen.coroutine
+    def _find_resume(self, tmpdir, gcode):
+        # Older plans of this file with checkpoints to resume from
+        plans = glob.glob(self.base + '.*.checkpoints.json')
+        plans = [path for path in plans if self.hid not in path]
+        if not plans: return
+
+        yield self._run_script(tmpdir, 'checkpoint.py', 'resume', gcode,
+                               json.dumps(self.config), *plans)
+
+        path = tmpdir + '/resume.json'
+        if os.path.exists(path):
+            with open(path, 'r') as f: resume = json.load(f)
+
+            self.preplanner.log.info('Resuming plan at line %d',
+                                     resume['checkpoint']['line'])
+            return resume
+
+
     @gen.coroutine
     def _exec(self):
         self.clean() # Clean up old plans
 
         with tempfile.TemporaryDirectory() as tmpdir:
+            gcode = os.path.abspath(self.gcode)
+            resume = yield self._find_resume(tmpdir, gcode)
+            if self.cancel: return
+
+            config = dict(self.config)
+            args = ['--checkpoint-lines=%d' %
+                    self.preplanner.checkpoint_lines]
+
+            if resume is not None:
+                # Resumed plans start after program-start has run
+                config.pop('program-start', None)
+                gcode = tmpdir + '/resume.gcode'
+                args.append('--resume=resume.json')
+
             cmd = (
                 '/usr/bin/env', 'python3',
                 bbctrl.get_resource('plan.py'),
-                os.path.abspath(self.gcode), json.dumps(self.state),
-                json.dumps(self.config),
+                gcode, json.dumps(self.state), json.dumps(config),
                 '--max-time=%s' % self.preplanner.max_plan_time,
-                '--max-loop=%s' % self.preplanner.max_loop_time
-            )
+                '--max-loop=%s' % self.preplanner.max_loop_time,
+                *args)
 
             self.preplanner.log.info('Running: %s', cmd)
 
@@ -183,10 +246,23 @@ class Plan(object):
                 proc.stderr.close()
                 proc.stdout.close()
 
+            if self.cancel: return
+
+            # Split the path in to chunks for progressive loading
+            vertices = resume['checkpoint']['vertices'] if resume else 0
+            yield self._run_script(tmpdir, 'chunk.py', 'positions.gz',
+                                   'speeds.gz',
+                                   '--prefix-vertices=%d' % vertices)
+            if self.cancel: return
+
+            # Record where later plans of this file can resume
+            yield self._run_script(tmpdir, 'checkpoint.py', 'index',
+                                   os.path.abspath(self.gcode),
+                                   json.dumps(self.config), 'checkpoints.json')
+
             if not self.cancel:
-                os.rename(tmpdir + '/meta.json',    self.files[0])
-                os.rename(tmpdir + '/positions.gz', self.files[1])
-                os.rename(tmpdir + '/speeds.gz',    self.files[2])
+                for name, path in zip(plan_files, self.files):
+                    os.rename(tmpdir + '/' + name, path)
                 os.sync()
 
 
@@ -199,7 +275,13 @@ class Plan(object):
                     self.future.set_result(data)
                     return
 
-            if not self._exists(): yield self._exec()
+            if not self._exists():
+                # Wait for a free worker
+                if (yield self.preplanner._acquire(self)):
+                    try:
+                        yield self._exec()
+                    finally: self.preplanner._release(self)
+
             self.future.set_result(self._read())
 
         except:
@@ -208,12 +290,19 @@ class Plan(object):
 
 
 class Preplanner(object):
-    def __init__(self, ctrl, max_plan_time = 60 * 60 * 24, max_loop_time = 300):
+    def __init__(self, ctrl, max_plan_time = 60 * 60 * 24, max_loop_time = 300,
+                 max_workers = None, plan_memory = 64 * 1024 * 1024,
+                 checkpoint_lines = 1000):
         self.ctrl = ctrl
         self.log = ctrl.log.get('Preplanner')
 
         self.max_plan_time = max_plan_time
         self.max_loop_time = max_loop_time
+        self.max_workers = max_workers
+        self.plan_memory = plan_memory
+        self.checkpoint_lines = checkpoint_lines
+        self.pending = []
+        self.running = set()
 
         path = self.ctrl.get_plan()
         if not os.path.exists(path): os.mkdir(path)
@@ -222,6 +311,54 @@ class Preplanner(object):
         self.plans = {}
 
 
+    def _get_max_workers(self):
+        if self.max_workers is not None: return self.max_workers
+
+        # Leave a core for the real-time planner
+        workers = max(1, (os.cpu_count() or 1) - 1)
+
+        # Only start more planners if free memory can hold them
+        mem = available_memory()
+        if mem is not None:
+            workers = min(workers, len(self.running) + mem // self.plan_memory)
+
+        return max(1, workers)
+
+
+    def _schedule(self):
+        # Release cancelled plans so they can finish
+        for entry in list(self.pending):
+            if entry[0].cancel:
+                self.pending.remove(entry)
+                entry[1].set_result(False)
+
+        # Selected file first then in request order
+        selected = self.ctrl.state.get('selected', None)
+
+        while self.pending and len(self.running) < self._get_max_workers():
+            entry = self.pending[0]
+            for e in self.pending:
+                if e[0].filename == selected:
+                    entry = e
+                    break
+
+            self.pending.remove(entry)
+            self.running.add(entry[0])
+            entry[1].set_result(True)
+
+
+    def _acquire(self, plan):
+        future = Future()
+        self.pending.append((plan, future))
+        self._schedule()
+        return future
+
+
+    def _release(self, plan):
+        self.running.discard(plan)
+        self._schedule()
+
+
     def start(self):
         if not self.started.done():
             self.log.info('Preplanner started')
@@ -232,12 +369,14 @@ class Preplanner(object):
         if filename in self.plans:
             self.plans[filename].terminate()
             del self.plans[filename]
+            self._schedule()
 
 
     def invalidate_all(self):
         for filename, plan in self.plans.items():
             plan.terminate()
         self.plans = {}
+        self._schedule()
 
 
     def delete_all_plans(self):
@@ -267,5 +406,16 @@ class Preplanner(object):
         return data
 
 
+    def get_checkpoints(self, filename):
+        plan = self.plans.get(filename)
+        if plan is None or not plan.future.done(): return []
+
+        try:
+            with open(plan.files[3], 'r') as f: data = json.load(f)
+            if data.get('version') != checkpoint.version: return []
+            return data['checkpoints']
+        except: return []
+
+
     def get_plan_progress(self, filename):
         return self.plans[filename].progress if filename in self.plans else 0
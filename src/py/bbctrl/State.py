@@ -29,10 +29,17 @@ import traceback
 import copy
 import uuid
 import os
+import time
 import bbctrl
 
 
 class State(object):
+    # Vars which change continuously while moving, notified sooner
+    fast_vars = set([axis + 'p' for axis in 'xyzabc'] + ['v'])
+    fast_delay = 0.05
+    delay = 0.25
+
+
     def __init__(self, ctrl):
         self.ctrl = ctrl
         self.log = ctrl.log.get('State')
@@ -41,6 +48,7 @@ class State(object):
         self.changes = {}
         self.listeners = []
         self.timeout = None
+        self.deadline = None
         self.machine_var_set = set()
         self.message_id = 0
 
@@ -72,6 +80,8 @@ class State(object):
                               lambda name, i = i: self.motor_search_velocity(i))
             self.set_callback(str(i) + 'latch_velocity',
                               lambda name, i = i: self.motor_latch_velocity(i))
+            self.set_callback(str(i) + 'latch_position',
+                              lambda name, i = i: self.get('%dlp' % i, 0))
 
         self.set_callback('metric', lambda name: 1 if self.is_metric() else 0)
         self.set_callback('imperial', lambda name: 0 if self.is_metric() else 1)
@@ -175,6 +185,17 @@ class State(object):
         self.timeout = None
 
 
+    def _schedule(self, delay):
+        deadline = time.time() + delay
+
+        if self.timeout is not None:
+            if self.deadline <= deadline: return
+            self.ctrl.ioloop.remove_timeout(self.timeout)
+
+        self.deadline = deadline
+        self.timeout = self.ctrl.ioloop.call_later(delay, self._notify)
+
+
     def resolve(self, name):
         # Resolve axis prefixes to motor numbers
         if 2 < len(name) and name[1] == '_' and name[0] in 'xyzabc':
@@ -196,8 +217,8 @@ class State(object):
             self.changes[name] = value
 
             # Trigger listener notify
-            if self.timeout is None:
-                self.timeout = self.ctrl.ioloop.call_later(0.25, self._notify)
+            self._schedule(self.fast_delay if name in self.fast_vars
+                           else self.delay)
 
 
     def update(self, update):
@@ -247,7 +268,7 @@ class State(object):
 
     def add_listener(self, listener):
         self.listeners.append(listener)
-        listener(self.vars)
+        listener(dict(self.vars))
 
 
     def remove_listener(self, listener): self.listeners.remove(listener)
@@ -351,6 +372,10 @@ class State(object):
             if mode == 'switch-max' and not int(self.get(axis + '_xs', 0)):
                 return 'Configured for max switch but switch is disabled'
 
+            if mode[:6] == 'stall-' and not int(self.get(axis + '_th', 0)):
+                return 'Configured for stall homing but stall threshold ' \
+                    'is not calibrated'
+
         softMin = int(self.get(axis + '_tn', 0))
         softMax = int(self.get(axis + '_tm', 0))
         if softMax <= softMin + 1:
@@ -367,21 +392,23 @@ class State(object):
         if mode == '0': return 'manual'
         if mode == '1': return 'switch-min'
         if mode == '2': return 'switch-max'
+        if mode == '3': return 'stall-min'
+        if mode == '4': return 'stall-max'
         raise Exception('Unrecognized homing mode "%s"' % mode)
 
 
     def motor_home_direction(self, motor):
         mode = self.motor_homing_mode(motor)
-        if mode == 'switch-min': return -1
-        if mode == 'switch-max': return 1
+        if mode in ('switch-min', 'stall-min'): return -1
+        if mode in ('switch-max', 'stall-max'): return 1
         return 0 # Disabled
 
 
     def motor_home_position(self, motor):
         mode = self.motor_homing_mode(motor)
         # Return soft limit positions
-        if mode == 'switch-min': return self.vars['%dtn' % motor]
-        if mode == 'switch-max': return self.vars['%dtm' % motor]
+        if mode in ('switch-min', 'stall-min'): return self.vars['%dtn' % motor]
+        if mode in ('switch-max', 'stall-max'): return self.vars['%dtm' % motor]
         return 0 # Disabled
 
 
@@ -424,13 +451,17 @@ class State(object):
             raise Exception('Switch "%s-%s" axis not enabled' % (axis, side))
 
         motor = self.find_motor(axis)
+
+        # Stall homing replaces the switch on the homing side
         # This must match the switch ID enum in avr/src/switch.h
+        if self.motor_homing_mode(motor) == 'stall-' + side.lower():
+            return 10 + motor
+
         return 2 * motor + 2 + (0 if side.lower() == 'min' else 1)
 
 
     def get_switch_id(self, switch):
         # TODO Support other input switches in CAMotics gcode/machine/PortType.h
-        # TODO Support stall homing
         switch = switch.lower()
         if switch == 'probe': return 1
         if switch[1:] == '-min': return self.get_axis_switch(switch[0], 'min')
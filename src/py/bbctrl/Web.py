@@ -36,11 +36,16 @@ import tarfile
 import subprocess
 import socket
 import time
+import copy
 from tornado.web import HTTPError
 from tornado import web, gen
 
 import bbctrl
 
+try:
+    import msgpack
+except ImportError: msgpack = None
+
 
 
 def call_get_output(cmd):
@@ -280,6 +285,55 @@ class UpgradeHandler(bbctrl.APIHandler):
 
 
 class PathHandler(bbctrl.APIHandler):
+    def _parse_range(self, size):
+        header = self.request.headers.get('Range')
+        if header is None or not header.startswith('bytes='): return
+
+        try:
+            start, end = header[6:].split(',')[0].split('-')
+
+            if start == '': start, end = max(size - int(end), 0), size
+            else:
+                start = int(start)
+                end = min(int(end) + 1, size) if end else size
+
+        except ValueError: return
+
+        if end <= start: raise HTTPError(416, 'Invalid range')
+
+        return start, end
+
+
+    @gen.coroutine
+    def _send_file(self, path, filename):
+        size = os.path.getsize(path)
+        start, end = 0, size
+
+        r = self._parse_range(size)
+        if r is not None:
+            start, end = r
+            self.set_status(206)
+            self.set_header('Content-Range', 'bytes %d-%d/%d' % (
+                start, end - 1, size))
+
+        self.set_header('Content-Disposition', 'filename="%s"' % filename)
+        self.set_header('Content-Type', 'application/octet-stream')
+        self.set_header('Accept-Ranges', 'bytes')
+        self.set_header('Content-Length', str(end - start))
+
+        # Respond with chunks to avoid long delays
+        SIZE = 102400
+        with open(path, 'rb') as f:
+            f.seek(start)
+
+            while start < end:
+                chunk = f.read(min(SIZE, end - start))
+                if not chunk: break
+                start += len(chunk)
+                self.write(chunk)
+                yield self.flush()
+
+
     @gen.coroutine
     def get(self, filename, dataType, *args):
         if not os.path.exists(self.get_upload(filename)):
@@ -299,26 +353,19 @@ class PathHandler(bbctrl.APIHandler):
 
         try:
             if data is None: return
-            meta, positions, speeds = data
 
-            if dataType == '/positions': data = positions
-            elif dataType == '/speeds': data = speeds
-            else:
-                self.write_json(meta)
+            if dataType is None:
+                self.write_json(data['meta'])
                 return
 
-            filename = filename + '-' + dataType[1:] + '.gz'
-            self.set_header('Content-Disposition', 'filename="%s"' % filename)
-            self.set_header('Content-Type', 'application/octet-stream')
-            self.set_header('Content-Encoding', 'gzip')
-            self.set_header('Content-Length', str(len(data)))
+            dataType = dataType[1:]
 
-            # Respond with chunks to avoid long delays
-            SIZE = 102400
-            chunks = [data[i:i + SIZE] for i in range(0, len(data), SIZE)]
-            for chunk in chunks:
-                self.write(chunk)
-                yield self.flush()
+            if dataType == 'chunks':
+                self.write_json(data['chunks'])
+                return
+
+            if dataType == 'path':
+                yield self._send_file(data['path'], filename + '-path.bin')
 
         except tornado.iostream.StreamClosedError as e: pass
 
@@ -334,11 +381,15 @@ class HomeHandler(bbctrl.APIHandler):
             self.get_ctrl().mach.home(axis, self.json['position'])
 
         elif action == '/clear': self.get_ctrl().mach.unhome(axis)
+        elif action == '/stall-calibrate':
+            self.get_ctrl().mach.calibrate_stall(axis)
         else: self.get_ctrl().mach.home(axis)
 
 
 class StartHandler(bbctrl.APIHandler):
-    def put_ok(self): self.get_ctrl().mach.start()
+    def put_ok(self):
+        line = self.json.get('line')
+        self.get_ctrl().mach.start(None if line is None else int(line))
 
 
 class EStopHandler(bbctrl.APIHandler):
@@ -413,9 +464,20 @@ class JogHandler(bbctrl.APIHandler):
 
 # Base class for Web Socket connections
 class ClientConnection(object):
+    # Minimum seconds between state updates by class of variable
+    fast_rate = 0.05
+    rate = 0.25
+
+
     def __init__(self, app):
         self.app = app
         self.count = 0
+        self.binary = False
+        self.sent = {}
+        self.pending = {}
+        self.shared = None
+        self.last = {True: 0, False: 0}
+        self.flush_timer = None
 
 
     def heartbeat(self):
@@ -424,22 +486,78 @@ class ClientConnection(object):
         self.count += 1
 
 
-    def send(self, msg): raise HTTPError(400, 'Not implemented')
+    def send(self, msg): self.write(self.app.encode(msg, self.binary))
+    def write(self, data): raise HTTPError(400, 'Not implemented')
+
+
+    def _update(self, changes):
+        # Updates are sent as is when nothing else is pending so Web.encode()
+        # can share their encoding between clients
+        shared = not self.pending
+
+        # Only send what this client does not already have
+        for name, value in changes.items():
+            if name in self.sent and self.sent[name] == value:
+                self.pending.pop(name, None)
+                shared = False
+            else: self.pending[name] = value
+
+        self.shared = changes if shared else None
+        self._flush()
+
+
+    def _flush(self):
+        self.flush_timer = None
+        now = time.time()
+        fast_vars = self.ctrl.state.fast_vars
+        msg = {}
+        wait = None
+
+        for fast in (True, False):
+            names = [name for name in self.pending
+                     if (name in fast_vars) == fast]
+            if not names: continue
+
+            rate = self.fast_rate if fast else self.rate
+            delay = self.last[fast] + rate - now
+
+            if delay <= 0:
+                self.last[fast] = now
+                for name in names: msg[name] = self.pending.pop(name)
+
+            elif wait is None or delay < wait: wait = delay
+
+        if msg:
+            for name, value in msg.items():
+                # Lists may be changed in place
+                self.sent[name] = copy.copy(value)
+
+            if self.shared is not None and len(msg) == len(self.shared):
+                msg = self.shared
+
+            self.shared = None
+            self.send(msg)
+
+        if wait is not None and self.flush_timer is None and self.is_open:
+            self.flush_timer = self.app.ioloop.call_later(wait, self._flush)
 
 
     def on_open(self, id = None):
         self.ctrl = self.app.get_ctrl(id)
 
-        self.ctrl.state.add_listener(self.send)
-        self.ctrl.log.add_listener(self.send)
         self.is_open = True
+        self.ctrl.state.add_listener(self._update)
+        self.ctrl.log.add_listener(self.send)
         self.heartbeat()
         self.app.opened(self.ctrl)
 
 
     def on_close(self):
         self.app.ioloop.remove_timeout(self.timer)
-        self.ctrl.state.remove_listener(self.send)
+        if self.flush_timer is not None:
+            self.app.ioloop.remove_timeout(self.flush_timer)
+            self.flush_timer = None
+        self.ctrl.state.remove_listener(self._update)
         self.ctrl.log.remove_listener(self.send)
         self.is_open = False
         self.app.closed(self.ctrl)
@@ -448,15 +566,21 @@ class ClientConnection(object):
     def on_message(self, data): self.ctrl.mach.mdi(data)
 
 
-# Used by CAMotics
+# Used by CAMotics, connect with ?format=msgpack for binary frames
 class WSConnection(ClientConnection, tornado.websocket.WebSocketHandler):
     def __init__(self, app, request, **kwargs):
         ClientConnection.__init__(self, app)
         tornado.websocket.WebSocketHandler.__init__(
             self, app, request, **kwargs)
 
-    def send(self, msg): self.write_message(msg)
-    def open(self): self.on_open()
+
+    def write(self, data): self.write_message(data, binary = self.binary)
+
+
+    def open(self):
+        format = self.get_query_argument('format', 'json')
+        self.binary = format == 'msgpack' and msgpack is not None
+        self.on_open()
 
 
 # Used by Web frontend
@@ -466,9 +590,12 @@ class SockJSConnection(ClientConnection, sockjs.tornado.SockJSConnection):
         sockjs.tornado.SockJSConnection.__init__(self, session)
 
 
-    def send(self, msg):
+    def write(self, data):
+        # Already JSON encoded, as sockjs.tornado's broadcast() does
         try:
-            sockjs.tornado.SockJSConnection.send(self, msg)
+            if self.session.send_expects_json:
+                self.session.send_jsonified(data)
+            else: self.session.send_message(data)
         except:
             self.close()
 
@@ -496,6 +623,7 @@ class Web(tornado.web.Application):
         self.args = args
         self.ioloop = ioloop
         self.ctrls = {}
+        self.encoded = {}
 
         # Init camera
         if not args.disable_camera:
@@ -526,8 +654,9 @@ class Web(tornado.web.Application):
             (r'/api/firmware/update', FirmwareUpdateHandler),
             (r'/api/upgrade', UpgradeHandler),
             (r'/api/file(/[^/]+)?', bbctrl.FileHandler),
-            (r'/api/path/([^/]+)((/positions)|(/speeds))?', PathHandler),
-            (r'/api/home(/[xyzabcXYZABC]((/set)|(/clear))?)?', HomeHandler),
+            (r'/api/path/([^/]+)(/chunks|/path)?', PathHandler),
+            (r'/api/home(/[xyzabcXYZABC]((/set)|(/clear)|(/stall-calibrate))?)?',
+             HomeHandler),
             (r'/api/start', StartHandler),
             (r'/api/estop', EStopHandler),
             (r'/api/clear', ClearHandler),
@@ -563,6 +692,19 @@ class Web(tornado.web.Application):
         print('Listening on http://%s:%d/' % (args.addr, args.port))
 
 
+    def encode(self, msg, binary = False):
+        # Clients are usually sent the same update, only encode it once
+        last = self.encoded.get(binary)
+        if last is not None and last[0] is msg: return last[1]
+
+        if binary: data = msgpack.packb(msg, use_bin_type = True)
+        else: data = json.dumps(msg, separators = (',', ':'))
+
+        self.encoded[binary] = (msg, data)
+
+        return data
+
+
     def opened(self, ctrl): ctrl.clear_timeout()
 
 
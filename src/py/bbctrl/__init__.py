@@ -158,6 +158,8 @@ def parse_args():
                         help = 'Enable debug mode and set frequency in seconds')
     parser.add_argument('--fast-emu', action = 'store_true',
                         help = 'Enter demo mode')
+    parser.add_argument('--log-comm', action = 'store_true',
+                        help = 'Log commands to and messages from the AVR')
     parser.add_argument('--client-timeout', default = 5 * 60, type = int,
                         help = 'Demo client timeout in seconds')
 
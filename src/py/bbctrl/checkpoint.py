@@ -0,0 +1,467 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#                This file is part of the Buildbotics firmware.                #
+#                                                                              #
+#                  Copyright (c) 2015 - 2018, Buildbotics LLC                  #
+#                             All rights reserved.                             #
+#                                                                              #
+#     This file ("the software") is free software: you can redistribute it     #
+#     and/or modify it under the terms of the GNU General Public License,      #
+#      version 2 as published by the Free Software Foundation. You should      #
+#      have received a copy of the GNU General Public License, version 2       #
+#     along with the software. If not, see <http://www.gnu.org/licenses/>.     #
+#                                                                              #
+#     The software is distributed in the hope that it will be useful, but      #
+#          WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       #
+#               Lesser General Public License for more details.                #
+#                                                                              #
+#       You should have received a copy of the GNU Lesser General Public       #
+#                License along with the software.  If not, see                 #
+#                       <http://www.gnu.org/licenses/>.                        #
+#                                                                              #
+#                For information regarding this software email:                #
+#                  "Joseph Coffland" <joseph@buildbotics.com>                  #
+#                                                                              #
+
+# Indexes planner checkpoints so planning can resume part way through a file.
+#
+# The planner records a checkpoint every N lines with its outputs so far and
+# its position.  index annotates each checkpoint with a hash of the GCode
+# before its line and the modal state the text has set, as GCode which
+# restores it.  After an edit, resume finds the last checkpoint of an older
+# plan of the same file whose prefix hash and config still match and writes
+# resume.gcode, the modal preamble followed by the rest of the file, for the
+# planner to continue from.
+#
+# The motion mode is restored by prefixing it to the first move after the
+# checkpoint because G2 or G3 alone on a line is not a complete arc.
+#
+# Checkpoints after GCode whose effects the preamble cannot restore, such as
+# parameters, subroutines, offset changes or canned cycles, are not resumable.
+#
+# The controller imports this module to start jobs part way through a file
+# from the nearest checkpoint, see restart().  Index also records the
+# position the text has moved to, in program coordinates, and the highest Z
+# so far so a restarted job can approach its first line from above.
+
+import sys
+import os
+import re
+import argparse
+import json
+import hashlib
+import shutil
+
+
+reComment = re.compile(r'\([^)]*\)|;.*')
+reWord = re.compile(r'([A-Z])\s*([-+]?(?:\d+\.?\d*|\.\d+))')
+reBlockStart = re.compile(rb'^\s*(?:/\s*)?(?:[Nn]\s*\d+\s*)?')
+
+# Checkpoint format, older indexes are ignored
+version = 2
+
+# Modal groups restored by the preamble, in the order they are restored
+modal_groups = {
+    'units':    (20, 21),
+    'distance': (90, 91),
+    'arc':      (90.1, 91.1),
+    'plane':    (17, 18, 19, 17.1, 18.1, 19.1),
+    'coords':   (54, 55, 56, 57, 58, 59, 59.1, 59.2, 59.3),
+    'feed':     (93, 94, 95),
+    'path':     (61, 61.1, 64),
+    'comp':     (40, 41, 42),
+    'length':   (43, 43.1, 43.2, 49),
+}
+
+# GCodes which change state the preamble cannot restore
+unsafe_gcodes = (10, 28.1, 30.1, 38.2, 38.3, 38.4, 38.5, 52, 92, 92.1, 92.2,
+                 92.3)
+
+# Motion modes, canned cycles leave sticky R, Q and retract state behind
+motion_gcodes = (0, 1, 2, 3, 80)
+canned_gcodes = (73, 76, 81, 82, 83, 84, 85, 86, 87, 88, 89)
+
+# Non-modal GCodes which take axis words without moving in the motion mode
+axis_gcodes = (10, 28, 30, 52, 92)
+axis_words = 'XYZABCUVWIJKR'
+position_axes = 'XYZABC'
+
+
+def hash_dump(o):
+    s = json.dumps(o, separators = (',', ':'), sort_keys = True)
+    return s.encode('utf8')
+
+
+def config_key(config):
+    # The planner consumes all of the config but program-start only runs
+    # before the first checkpoint, the M6 override only matters if the prefix
+    # changes tools and the program end override only runs at the end.
+    core = {k: v for k, v in config.items()
+            if k not in ('program-start', 'overrides')}
+    overrides = config.get('overrides', {})
+
+    return dict(
+        core = hashlib.sha256(hash_dump(core)).hexdigest(),
+        start = config.get('program-start'),
+        toolChange = overrides.get('M6'),
+        end = overrides.get('M2'))
+
+
+def format_number(value): return ('%f' % value).rstrip('0').rstrip('.')
+
+
+class Modal(object):
+    def __init__(self):
+        self.groups = {}
+        self.args = {}
+        self.words = {}
+        self.motion = None
+        self.position = {}
+        self.safe_z = None
+        self.spindle = None
+        self.coolant = set()
+        self.safe = True
+        self.ended = False
+        self.tool_change = False
+
+
+    def update(self, line):
+        line = reComment.sub('', line.upper())
+        if '#' in line or '[' in line: self.safe = False
+
+        words = [(m.group(1), float(m.group(2)))
+                 for m in reWord.finditer(line)]
+        frame = (self.groups.get('units'), self.groups.get('coords'))
+
+        for letter, value in words:
+            if letter == 'O': self.safe = False
+
+            elif letter == 'G':
+                if value in unsafe_gcodes: self.safe = False
+                if value in motion_gcodes or value in canned_gcodes:
+                    self.motion = value
+
+                for group, codes in modal_groups.items():
+                    if value in codes:
+                        self.groups[group] = value
+                        if group == 'path':
+                            self.args[group] = [
+                                '%s%s' % (l, format_number(v))
+                                for l, v in words if l in 'PQ']
+
+            elif letter == 'M':
+                if value in (3, 4, 5): self.spindle = value
+                elif value in (7, 8): self.coolant.add(value)
+                elif value == 9: self.coolant.clear()
+                elif value == 6: self.tool_change = True
+                elif value in (2, 30): self.ended = True
+                elif value == 98 or value == 99: self.safe = False
+
+            elif letter in 'FST': self.words[letter] = value
+
+        self._update_position(words, frame)
+
+
+    def _update_position(self, words, frame):
+        codes = [v for l, v in words if l == 'G']
+
+        # Moves the text cannot follow in program coordinates
+        if (frame != (self.groups.get('units'), self.groups.get('coords')) or
+            any(c in (28, 30) for c in codes) or ('M', 6) in words):
+            self.position.clear()
+            self.safe_z = None
+            return
+
+        if any(c in axis_gcodes for c in codes): return
+
+        relative = self.groups.get('distance') == 91
+
+        for letter, value in words:
+            if letter not in position_axes: continue
+
+            if 53 in codes: self.position.pop(letter, None)
+            elif not relative: self.position[letter] = value
+            elif letter in self.position: self.position[letter] += value
+
+        # Canned cycles end at the retract plane
+        if self.motion in canned_gcodes: self.position.pop('Z', None)
+
+        z = self.position.get('Z')
+        if z is not None and (self.safe_z is None or self.safe_z < z):
+            self.safe_z = z
+
+
+    def resumable(self):
+        return (self.safe and not self.ended and
+                self.motion not in canned_gcodes and
+                self.groups.get('comp', 40) == 40 and
+                self.groups.get('length', 49) == 49)
+
+
+    def approach(self):
+        '''GCode which retracts to the highest Z so far, moves over the
+        current position and feeds down to it or None if the position is
+        unknown'''
+        if self.groups.get('feed', 94) != 94 or 'F' not in self.words:
+            return None
+
+        pos = self.position
+        if not all(axis in pos for axis in 'XYZ'): return None
+
+        xy = ['%s%s' % (axis, format_number(pos[axis]))
+              for axis in position_axes if axis in pos and axis != 'Z']
+
+        lines = ['G90 G0 Z' + format_number(self.safe_z),
+                 'G0 ' + ' '.join(xy),
+                 'G1 Z' + format_number(pos['Z'])]
+
+        if self.groups.get('distance') == 91: lines.append('G91')
+
+        return lines
+
+
+    def preamble(self, approach = None):
+        lines = []
+
+        for group in modal_groups:
+            if group in self.groups:
+                words = ['G' + format_number(self.groups[group])]
+                words += self.args.get(group, [])
+                lines.append(' '.join(words))
+
+        for letter in 'FST':
+            if letter in self.words:
+                lines.append(letter + format_number(self.words[letter]))
+
+        if self.spindle is not None: lines.append('M%d' % self.spindle)
+        for code in sorted(self.coolant): lines.append('M%d' % code)
+        if approach is not None: lines += approach
+
+        # Other motion modes are restored by copy_gcode()
+        if self.motion == 80: lines.append('G80')
+
+        return lines
+
+
+def copy_gcode(f, out, motion):
+    '''Copies the rest of f to out with the motion mode prefixed to its first
+    move which does not set one'''
+    if motion in (0, 1, 2, 3):
+        for line in f:
+            text = reComment.sub('', line.decode('utf8', 'replace').upper())
+            words = reWord.findall(text)
+            codes = [float(v) for l, v in words if l == 'G']
+
+            if any(c in motion_gcodes or c in canned_gcodes or
+                   c in unsafe_gcodes for c in codes):
+                out.write(line)
+                break
+
+            if (any(l in axis_words for l, v in words) and
+                not any(c in axis_gcodes for c in codes)):
+                start = reBlockStart.match(line).end()
+                prefix = ('G%s ' % format_number(motion)).encode('utf8')
+                out.write(line[:start] + prefix + line[start:])
+                break
+
+            out.write(line)
+
+    shutil.copyfileobj(f, out)
+
+
+def scan(path, config):
+    '''Yields line number, byte offset, prefix hash and modal state before
+    each line of the file'''
+    h = hashlib.sha256()
+    modal = Modal()
+    offset = 0
+
+    # Resumed plans skip program-start so its modal state must be restored
+    for line in config.get('program-start', '').splitlines():
+        modal.update(line)
+
+    with open(path, 'rb') as f:
+        for number, line in enumerate(f, 1):
+            yield number, offset, h, modal
+
+            h.update(line)
+            offset += len(line)
+            modal.update(line.decode('utf8', 'replace'))
+
+    yield number + 1 if offset else 1, offset, h, modal
+
+
+def index(args):
+    config = json.loads(args.config)
+
+    with open(args.checkpoints, 'r') as f: checkpoints = json.load(f)
+    if isinstance(checkpoints, dict): checkpoints = checkpoints['checkpoints']
+
+    wanted = {}
+    for cp in checkpoints: wanted.setdefault(cp['line'], []).append(cp)
+
+    for number, offset, h, modal in scan(args.gcode, config):
+        for cp in wanted.pop(number, []):
+            cp['offset'] = offset
+            cp['hash'] = h.hexdigest()
+            cp['preamble'] = modal.preamble()
+            cp['motion'] = modal.motion
+            cp['axes'] = dict(modal.position)
+            cp['safeZ'] = modal.safe_z
+            cp['resumable'] = modal.resumable()
+            cp['toolChange'] = modal.tool_change
+            if 'T' in modal.words: cp['tool'] = int(modal.words['T'])
+
+        if not wanted: break
+
+    # Drop checkpoints past the end of the file
+    checkpoints = [cp for cp in checkpoints if 'hash' in cp]
+
+    with open(args.checkpoints, 'w') as f:
+        json.dump(dict(version = version, key = config_key(config),
+                       checkpoints = checkpoints), f)
+
+
+def usable(cp, key, old_key):
+    if not cp.get('resumable') or key['core'] != old_key['core']: return False
+    if key['start'] != old_key['start']: return False
+    return not cp['toolChange'] or key['toolChange'] == old_key['toolChange']
+
+
+def resume(args):
+    config = json.loads(args.config)
+    key = config_key(config)
+
+    # Old plans' checkpoints by line, a mismatch ends a plan's candidates
+    candidates = {}
+    for path in args.plans:
+        try:
+            with open(path, 'r') as f: data = json.load(f)
+            if data.get('version') != version: continue
+        except Exception: continue
+
+        for cp in data['checkpoints']:
+            candidates.setdefault(cp['line'], []).append(
+                (path, cp, usable(cp, key, data['key'])))
+
+    best = None
+    failed = set()
+    remaining = sum(len(c) for c in candidates.values())
+
+    for number, offset, h, modal in scan(args.gcode, config):
+        if not remaining: break
+
+        for path, cp, ok in candidates.pop(number, []):
+            remaining -= 1
+            if path in failed: continue
+            if cp['hash'] != h.hexdigest() or cp['offset'] != offset:
+                failed.add(path)
+            elif ok and (best is None or best[1]['line'] < number):
+                best = (path, cp)
+
+    if best is None: return
+
+    path, cp = best
+    base = path[:-len('checkpoints.json')]
+
+    with open(base + 'json', 'r') as f: meta = json.load(f)
+    with open(path, 'r') as f: data = json.load(f)
+
+    # Old outputs may be cleaned up while planning
+    shutil.copyfile(base + 'chunks.json', 'prefix.json')
+    shutil.copyfile(base + 'path.bin', 'prefix.bin')
+
+    preamble = cp['preamble']
+
+    with open('resume.gcode', 'wb') as out:
+        for line in preamble: out.write((line + '\n').encode('utf8'))
+
+        with open(args.gcode, 'rb') as f:
+            f.seek(cp['offset'])
+            copy_gcode(f, out, cp['motion'])
+
+    lines = sum(1 for line in open(args.gcode, 'rb'))
+    line = cp['line']
+
+    with open('resume.json', 'w') as f:
+        json.dump(dict(
+            checkpoint = cp,
+            lineOffset = line - 1 - len(preamble),
+            lines = lines,
+            checkpoints = [c for c in data['checkpoints']
+                           if c['line'] <= line],
+            messages = [m for m in meta['messages']
+                        if m.get('line') is not None and m['line'] < line]), f)
+
+
+def restart(path, config, checkpoints, line, out):
+    '''Writes GCode to out which runs path from line with the modal state it
+    would have had, approaching the line's start from above.  Scans forward
+    from the nearest resumable checkpoint.  Returns the line offset of the
+    output and the modal state.'''
+    cp = None
+    for c in checkpoints:
+        if c['line'] <= line and c.get('resumable') and \
+                (cp is None or cp['line'] < c['line']): cp = c
+
+    modal = Modal()
+
+    if cp is None:
+        for l in config.get('program-start', '').splitlines(): modal.update(l)
+        offset, number = 0, 1
+
+    else:
+        for l in cp['preamble']: modal.update(l)
+        modal.motion = cp['motion']
+        modal.position = dict(cp['axes'])
+        modal.safe_z = cp['safeZ']
+        offset, number = cp['offset'], cp['line']
+
+    with open(path, 'rb') as f:
+        f.seek(offset)
+
+        while number < line:
+            l = f.readline()
+            if not l: raise Exception('Line %d is past the end of file' % line)
+            modal.update(l.decode('utf8', 'replace'))
+            number += 1
+
+        if not modal.resumable():
+            raise Exception('Cannot start at line %d, GCode before it sets '
+                            'state which cannot be restored' % line)
+
+        approach = modal.approach()
+        if approach is None:
+            raise Exception('Cannot start at line %d, the position or feed '
+                            'rate before it is unknown' % line)
+
+        preamble = modal.preamble(approach)
+        for l in preamble: out.write((l + '\n').encode('utf8'))
+        copy_gcode(f, out, modal.motion)
+
+    return line - 1 - len(preamble), modal
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description = 'Buildbotics plan checkpoints')
+    sub = parser.add_subparsers(dest = 'command')
+
+    p = sub.add_parser('index', help = 'Annotate checkpoints with GCode state')
+    p.add_argument('gcode', help = 'The planned GCode file')
+    p.add_argument('config', help = 'Planner config')
+    p.add_argument('checkpoints', help = 'Checkpoints file to annotate')
+    p.set_defaults(func = index)
+
+    p = sub.add_parser('resume', help = 'Find a checkpoint to resume from')
+    p.add_argument('gcode', help = 'The GCode file to plan')
+    p.add_argument('config', help = 'Planner config')
+    p.add_argument('plans', nargs = '*', help = 'Older plan checkpoint files')
+    p.set_defaults(func = resume)
+
+    args = parser.parse_args()
+    if args.command is None: parser.error('Missing command')
+    args.func(args)
@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#                This file is part of the Buildbotics firmware.                #
+#                                                                              #
+#                  Copyright (c) 2015 - 2018, Buildbotics LLC                  #
+#                             All rights reserved.                             #
+#                                                                              #
+#     This file ("the software") is free software: you can redistribute it     #
+#     and/or modify it under the terms of the GNU General Public License,      #
+#      version 2 as published by the Free Software Foundation. You should      #
+#      have received a copy of the GNU General Public License, version 2       #
+#     along with the software. If not, see <http://www.gnu.org/licenses/>.     #
+#                                                                              #
+#     The software is distributed in the hope that it will be useful, but      #
+#          WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       #
+#               Lesser General Public License for more details.                #
+#                                                                              #
+#       You should have received a copy of the GNU Lesser General Public       #
+#                License along with the software.  If not, see                 #
+#                       <http://www.gnu.org/licenses/>.                        #
+#                                                                              #
+#                For information regarding this software email:                #
+#                  "Joseph Coffland" <joseph@buildbotics.com>                  #
+#                                                                              #
+################################################################################
+
+# Splits a planned toolpath in to fixed size chunks with decimated levels of
+# detail so the path viewer can fetch a coarse path first and refine it
+# progressively using HTTP byte ranges.
+#
+# path.bin holds every chunk's coarsest level first, then each chunk's next
+# finer level and so on, so full detail chunks are contiguous at the end.
+# chunks.json indexes it.  Consecutive chunks share their boundary vertex so
+# each chunk can be drawn as its own line strip.
+#
+# A level is encoded as:
+#
+#   positions  count * 3 varints, zigzag encoded deltas from the previous
+#              vertex of the x, y and z positions quantized to 1um relative
+#              to the job's origin
+#   palette    varint n, then n float32 speeds, NaN for rapids
+#   runs       varint n, then n pairs of varint length and palette index
+#
+# See src/js/toolpath.js for the decoder.
+
+import argparse
+import json
+import gzip
+import numpy as np
+
+
+QUANTUM = 0.001 # Position resolution in mm
+
+
+def load(path):
+    with gzip.open(path, 'rb') as f:
+        return np.frombuffer(f.read(), dtype = '<f4').astype(np.float32)
+
+
+def varints(values):
+    '''LEB128 encodes an array of unsigned values'''
+    values = np.asarray(values, dtype = np.uint64)
+    if not len(values): return b''
+
+    # Bytes per value, then each value's Nth byte is written in pass N
+    size = np.ones(len(values), dtype = np.int64)
+    for shift in range(7, 64, 7): size += values >= np.uint64(1 << shift)
+
+    out = np.empty(int(size.sum()), dtype = np.uint8)
+    starts = np.cumsum(size) - size
+
+    for n in range(int(size.max())):
+        more = n < size
+        b = (values[more] >> np.uint64(7 * n)) & np.uint64(0x7f)
+        b |= np.where(n + 1 < size[more], 0x80, 0).astype(np.uint64)
+        out[starts[more] + n] = b
+
+    return out.tobytes()
+
+
+def read_varints(data, offset, count):
+    '''Decodes count varints, returns the values and the next offset'''
+    if not count: return np.zeros(0, dtype = np.uint64), offset
+
+    b = np.frombuffer(data, dtype = np.uint8, offset = offset)
+    ends = np.flatnonzero(b < 0x80)[:count]
+    if len(ends) < count: raise Exception('Truncated toolpath data')
+
+    b = b[:ends[-1] + 1].astype(np.uint64)
+    starts = np.concatenate(([0], ends[:-1] + 1))
+    shift = np.arange(len(b)) - np.repeat(starts, ends - starts + 1)
+    parts = (b & np.uint64(0x7f)) << (np.uint64(7) * shift.astype(np.uint64))
+
+    return np.add.reduceat(parts, starts), offset + len(b)
+
+
+def encode(positions, speeds, origin):
+    # Quantized, delta and zigzag encoded positions
+    p = positions.reshape(-1, 3).astype(np.float64)
+    q = np.rint((p - origin) / QUANTUM)
+    q = np.where(np.isnan(q), 0, q).astype(np.int64)
+    d = np.diff(q, axis = 0, prepend = np.zeros((1, 3), dtype = np.int64))
+    d = d.ravel()
+    out = bytearray(varints(((d << 1) ^ (d >> 63)).view(np.uint64)))
+
+    # Run length encoded speed palette, keyed by bits so NaN matches itself
+    bits = speeds.astype('<f4').view('<u4')
+    starts = np.flatnonzero(np.diff(bits, prepend = ~bits[:1]))
+    lengths = np.diff(np.append(starts, len(bits)))
+
+    # Palette in order of first use
+    keys, first, inverse = np.unique(bits, return_index = True,
+                                     return_inverse = True)
+    order = np.argsort(first)
+    rank = np.empty(len(keys), dtype = np.int64)
+    rank[order] = np.arange(len(keys))
+
+    out += varints([len(keys)])
+    out += keys[order].astype('<u4').tobytes()
+
+    out += varints([len(starts)])
+    out += varints(np.stack((lengths, rank[inverse.ravel()[starts]]), 1)
+                   .ravel())
+
+    return out
+
+
+def decode(data, offset, count, origin, quantum):
+    z, offset = read_varints(data, offset, count * 3)
+    d = (z >> np.uint64(1)).astype(np.int64) ^ -(z & np.uint64(1)).astype(
+        np.int64)
+    last = np.cumsum(d.reshape(-1, 3), axis = 0)
+    positions = (np.asarray(origin) + last * quantum).astype(np.float32)
+
+    n, offset = read_varints(data, offset, 1)
+    n = int(n[0])
+    palette = np.frombuffer(data, dtype = '<f4', count = n, offset = offset)
+    offset += 4 * n
+
+    runs, offset = read_varints(data, offset, 1)
+    runs, offset = read_varints(data, offset, 2 * int(runs[0]))
+    runs = runs.reshape(-1, 2).astype(np.int64)
+    speeds = np.repeat(palette[runs[:, 1]], runs[:, 0]).astype(np.float32)
+
+    return positions.ravel(), speeds
+
+
+def load_prefix(args):
+    '''Full detail vertices of a previous plan this one resumes'''
+    with open(args.prefix_index, 'r') as f: index = json.load(f)
+    with open(args.prefix_path, 'rb') as f: data = f.read()
+
+    positions, speeds = [], []
+    size = index['chunkSize']
+
+    for i, chunk in enumerate(index['chunks']):
+        start = i * size
+        if args.prefix_vertices <= start: break
+
+        level = chunk['levels'][0]
+        p, s = decode(data, level['offset'], level['count'], index['origin'],
+                      index['quantum'])
+
+        # Skip the vertex shared with the previous chunk
+        skip = 1 if i else 0
+        end = min(level['count'], args.prefix_vertices - start)
+        positions.append(p[skip * 3:end * 3])
+        speeds.append(s[skip:end])
+
+    return (np.concatenate(positions or [np.zeros(0, np.float32)]),
+            np.concatenate(speeds or [np.zeros(0, np.float32)]))
+
+
+def chunk_bounds(positions, start, end):
+    bounds = dict(min = [], max = [])
+    p = positions[start * 3:end * 3].reshape(-1, 3)
+
+    for axis in range(3):
+        values = p[:, axis]
+        values = values[~np.isnan(values)]
+        bounds['min'].append(float(values.min()) if len(values) else 0)
+        bounds['max'].append(float(values.max()) if len(values) else 0)
+
+    return bounds
+
+
+def decimate(positions, speeds, start, end, stride):
+    if stride == 1: return positions[start * 3:end * 3], speeds[start:end]
+
+    indices = np.arange(start, end, stride)
+    if indices[-1] != end - 1: indices = np.append(indices, end - 1)
+
+    return positions.reshape(-1, 3)[indices].ravel(), speeds[indices]
+
+
+def run(args):
+    positions = load(args.positions)
+    speeds = load(args.speeds)
+
+    if args.prefix_vertices:
+        p, s = load_prefix(args)
+        positions = np.concatenate((p, positions))
+        speeds = np.concatenate((s, speeds))
+
+    count = len(speeds)
+    if len(positions) != count * 3:
+        raise Exception('Positions and speeds do not match')
+
+    # Chunk vertex ranges, overlapping by one vertex
+    ranges = []
+    for start in range(0, max(count - 1, 1), args.chunk_size):
+        ranges.append((start, min(start + args.chunk_size + 1, count)))
+
+    # Decimated levels, each keeps every Nth vertex and the chunk end
+    levels = [[] for r in ranges]
+    for i, (start, end) in enumerate(ranges):
+        stride = 1
+
+        while True:
+            levels[i].append(stride)
+            stride *= args.lod_factor
+            if (end - start - 1) / stride < args.lod_min: break
+
+    chunks = [dict(bounds = chunk_bounds(positions, start, end),
+                   levels = [None] * len(levels[i]))
+              for i, (start, end) in enumerate(ranges)]
+
+    # Quantize relative to the job's minimum
+    origin = [min(c['bounds']['min'][axis] for c in chunks)
+              for axis in range(3)]
+
+    index = dict(version = 2, chunkSize = args.chunk_size, vertices = count,
+                 origin = origin, quantum = QUANTUM, chunks = chunks)
+
+    offset = 0
+    passes = max(len(l) for l in levels) if levels else 0
+
+    with open('path.bin', 'wb') as f:
+        # Each pass writes every chunk's next finer level
+        for depth in range(passes):
+            for i, (start, end) in enumerate(ranges):
+                if len(levels[i]) <= depth: continue
+                level = len(levels[i]) - 1 - depth
+
+                p, s = decimate(positions, speeds, start, end,
+                                levels[i][level])
+                data = encode(p, s, origin)
+                f.write(data)
+
+                chunks[i]['levels'][level] = dict(
+                    offset = offset, length = len(data), count = len(s))
+                offset += len(data)
+
+    with open('chunks.json', 'w') as f: json.dump(index, f)
+
+
+parser = argparse.ArgumentParser(description = 'Buildbotics toolpath chunker')
+parser.add_argument('positions', help = 'Planned positions file')
+parser.add_argument('speeds', help = 'Planned speeds file')
+parser.add_argument('--chunk-size', default = 65536, type = int,
+                    help = 'Vertices per chunk')
+parser.add_argument('--lod-factor', default = 16, type = int,
+                    help = 'Decimation between levels of detail')
+parser.add_argument('--lod-min', default = 64, type = int,
+                    help = 'Minimum vertices in a decimated level')
+parser.add_argument('--prefix-index', default = 'prefix.json',
+                    help = 'Index of a previous plan this one resumes')
+parser.add_argument('--prefix-path', default = 'prefix.bin',
+                    help = 'Path data of a previous plan this one resumes')
+parser.add_argument('--prefix-vertices', default = 0, type = int,
+                    help = 'Vertices to keep from the previous plan')
+
+run(parser.parse_args())
@@ -37,6 +37,7 @@ import re
 import gzip
 import struct
 import math
+import Cmd
 import camotics.gplan as gplan # pylint: disable=no-name-in-module,import-error
 
 
@@ -77,19 +78,23 @@ def compute_move(start, unit, dist):
 
 
 class Plan(object):
-    def __init__(self, path, state, config):
+    def __init__(self, path, state, config, resume = None):
         self.path = path
         self.state = state
         self.config = config
+        self.resume = resume
 
         self.lines = sum(1 for line in open(path, 'rb'))
+        self.lineOffset = 0
 
         self.planner = gplan.Planner()
         self.planner.set_resolver(self.get_var_cb)
         self.planner.set_logger(self._log_cb, 1, 'LinePlanner:3')
-        self.planner.load(self.path, config)
 
         self.messages = []
+        self.checkpoints = []
+        self.vars = {}
+        self.vertices = 0
         self.levels = dict(I = 'info', D = 'debug', W = 'warning', E = 'error',
                            C = 'critical')
 
@@ -105,6 +110,28 @@ class Plan(object):
         self.lastProgressTime = 0
         self.time = 0
 
+        if resume is not None: self.restore(resume)
+        self.planner.load(self.path, config)
+
+
+    def restore(self, resume):
+        cp = resume['checkpoint']
+
+        self.lines = resume['lines']
+        self.lineOffset = resume['lineOffset']
+        self.messages = resume['messages']
+        self.checkpoints = resume['checkpoints']
+        self.vars = dict(cp['vars'])
+        self.vertices = cp['vertices']
+        self.time = cp['time']
+        self.maxSpeed = cp['maxSpeed']
+        self.currentSpeed = cp['currentSpeed']
+
+        for side in ('min', 'max'):
+            self.bounds[side].update(cp['bounds'][side])
+
+        self.planner.set_position(cp['position'])
+
 
     def add_to_bounds(self, axis, value):
         if value < self.bounds['min'][axis]: self.bounds['min'][axis] = value
@@ -166,7 +193,7 @@ class Plan(object):
 
         where = ':'.join(filter(None.__ne__, [filename, line, column]))
 
-        if line is not None: line = int(line)
+        if line is not None: line = int(line) + self.lineOffset
         if column is not None: column = int(column)
 
         self.log_cb(level, msg, filename, line, column)
@@ -185,6 +212,26 @@ class Plan(object):
         sys.stdout.flush()
 
 
+    def checkpoint(self, line, position, output):
+        bounds = {side: {axis: value
+                         for axis, value in self.bounds[side].items()
+                         if math.isfinite(value)}
+                  for side in ('min', 'max')}
+
+        cp = dict(
+            line = line,
+            vertices = self.vertices,
+            time = self.time,
+            maxSpeed = self.maxSpeed,
+            currentSpeed = self.currentSpeed,
+            bounds = bounds,
+            position = dict(position),
+            vars = dict(self.vars))
+        cp.update(output)
+
+        self.checkpoints.append(cp)
+
+
     def _run(self):
         start = time.clock()
         line = 0
@@ -192,6 +239,14 @@ class Plan(object):
         maxLineTime = time.clock()
         position = {axis: 0 for axis in 'xyz'}
         rapid = False
+        every = args.checkpoint_lines
+        nextCheckpoint = every
+
+        if self.resume is not None:
+            cp = self.resume['checkpoint']
+            position.update(cp['position'])
+            line = maxLine = cp['line']
+            nextCheckpoint = line - line % every + every if every else 0
 
         # Execute plan
         try:
@@ -238,17 +293,26 @@ class Plan(object):
                     yield move
 
                 elif cmd['type'] == 'set':
+                    if cmd['name'] not in ('line', 'message'):
+                        self.vars[cmd['name']] = cmd['value']
+
                     if cmd['name'] == 'line':
-                        line = cmd['value']
+                        line = cmd['value'] + self.lineOffset
                         if maxLine < line:
                             maxLine = line
                             maxLineTime = time.clock()
 
+                        # Moves before this line have been output
+                        if every and nextCheckpoint <= line:
+                            nextCheckpoint = line - line % every + every
+                            yield {'checkpoint': line, 'position': position}
+
                     elif cmd['name'] == 'speed':
                         s = cmd['value']
                         if self.update_speed(s): yield {'s': s}
 
                 elif cmd['type'] == 'dwell': self.time += cmd['seconds']
+                elif cmd['type'] == 'input': Cmd.input_port(cmd['port'])
 
                 if args.max_time < time.clock() - start:
                     raise Exception('Max planning time (%d sec) exceeded.' %
@@ -269,10 +333,29 @@ class Plan(object):
         speed = 0
         first = True
         x, y, z = 0, 0, 0
+        p = None
+
+        if self.resume is not None:
+            cp = self.resume['checkpoint']
+            x, y, z = cp['point']
+            speed = cp['speed']
+            first = not self.vertices
+            lastS = struct.pack('<f', math.nan if cp['lastS'] is None
+                                else cp['lastS'])
+            p = struct.pack('<fff', x, y, z)
 
         with gzip.open('positions.gz', 'wb') as f1:
             with gzip.open('speeds.gz', 'wb') as f2:
                 for move in self._run():
+                    if 'checkpoint' in move:
+                        last = struct.unpack('<f', lastS)[0] if p else 0
+                        if math.isnan(last): last = None
+
+                        self.checkpoint(move['checkpoint'], move['position'],
+                                        dict(point = [x, y, z], speed = speed,
+                                             lastS = last))
+                        continue
+
                     x = move.get('x', x)
                     y = move.get('y', y)
                     z = move.get('z', z)
@@ -283,6 +366,7 @@ class Plan(object):
                     if not first and s != lastS:
                         f1.write(p)
                         f2.write(s)
+                        self.vertices += 1
 
                     lastS = s
                     first = False
@@ -290,6 +374,7 @@ class Plan(object):
 
                     f1.write(p)
                     f2.write(s)
+                    self.vertices += 1
 
         with open('meta.json', 'w') as f:
             meta = dict(
@@ -301,6 +386,8 @@ class Plan(object):
 
             json.dump(meta, f)
 
+        with open('checkpoints.json', 'w') as f: json.dump(self.checkpoints, f)
+
 
 parser = argparse.ArgumentParser(description = 'Buildbotics GCode Planner')
 parser.add_argument('gcode', help = 'The GCode file to plan')
@@ -313,12 +400,20 @@ parser.add_argument('--max-loop', default = 30,
                     type = int, help = 'Maximum time in loop in seconds')
 parser.add_argument('--nice', default = 10,
                     type = int, help = 'Set "nice" process priority')
+parser.add_argument('--checkpoint-lines', default = 0, type = int,
+                    help = 'Record a checkpoint every N lines, 0 for none')
+parser.add_argument('--resume', help = 'Resume from a checkpoint, see '
+                    'checkpoint.py')
 
 args = parser.parse_args()
 
 state = json.loads(args.state)
 config = json.loads(args.config)
 
+resume = None
+if args.resume:
+    with open(args.resume, 'r') as f: resume = json.load(f)
+
 os.nice(args.nice)
-plan = Plan(args.gcode, state, config)
+plan = Plan(args.gcode, state, config, resume)
 plan.run()